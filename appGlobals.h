@@ -49,8 +49,8 @@
 #endif
 #define FILE_NAME_LEN 64
 #define IN_FILE_NAME_LEN 128
-#define JSON_BUFF_LEN (1024 * 2) 
-#define MAX_CONFIGS 70 // > number of entries in configs.txt
+#define JSON_BUFF_LEN (1024 * 4) 
+#define MAX_CONFIGS 100 // > number of entries in configs.txt
 #define GITHUB_PATH "/s60sc/ESP32-Tuya_Device/main"
 
 #define STORAGE LittleFS // One of LittleFS or SD_MMC
@@ -71,7 +71,7 @@
 #define INCLUDE_WEBDAV true  // webDav.cpp (WebDAV protocol)
 
 // to determine if newer data files need to be loaded
-#define CFG_VER 3
+#define CFG_VER 13
 
 #ifdef CONFIG_IDF_TARGET_ESP32S3 
 #define SERVER_STACK_SIZE (1024 * 8)
@@ -85,6 +85,7 @@
 #define BATT_STACK_SIZE (1024 * 2)
 #define EMAIL_STACK_SIZE (1024 * 6)
 #define FS_STACK_SIZE (1024 * 4)
+#define JOB_STACK_SIZE (1024 * 5)
 #define LOG_STACK_SIZE (1024 * 3)
 #define MIC_STACK_SIZE (1024 * 4)
 #define MQTT_STACK_SIZE (1024 * 4)
@@ -104,33 +105,87 @@
 #define UART_PRI 1
 #define BATT_PRI 1
 #define IDLEMON_PRI 5
+#define JOB_PRI 1
 
 #define UART_RTS UART_PIN_NO_CHANGE
 #define UART_CTS UART_PIN_NO_CHANGE
 #define TUYA_BAUD_RATE 9600 
 #define BUFF_LEN (UART_FIFO_LEN * 2) // bigger than biggest tuya message
+#define LAT_BUCKETS 16 // log2 ms latency histogram buckets
+#define CAPTURE_DIR "/capture"
+#define LZS_EXT ".lzs"
+#define CAP_EXT "cap"
+#define IDX_EXT "idx"
 
 
 /******************** Function declarations *******************/                                        
 
+// called by uart writer task once frame queued by processTuyaMsg() is transmitted
+typedef void (*txDoneCB)(int uartNum, const byte* txData, size_t txLen, bool sent, int64_t queuedUs, int64_t doneUs, void* txArg);
+
 // global app specific functions
+esp_err_t dpCatalogue(httpd_req_t* req, const char* format);
+void dpWriteSent(uint8_t dpId);
+esp_err_t captureDownload(httpd_req_t* req, const char* fileName);
+void captureFlush();
+esp_err_t capturePcapng(httpd_req_t* req, const char* fileName);
+esp_err_t captureQuery(httpd_req_t* req, const char* filterStr);
 void heartBeat();
+void latencyAdd(struct latencyStruct& lat, uint32_t ms);
+uint32_t latencyPercentile(const struct latencyStruct& lat, int pcnt);
+void latencyJson(char* jsonStr, size_t jsonLen, const struct latencyStruct& lat);
+void latencySummary(const struct latencyStruct& lat, char* outStr, size_t outLen);
+void loadRules(const char* fileName);
+void localTimeData(byte* timeData);
+void networkStatusData(byte* statusData);
+esp_err_t pairingJson(httpd_req_t* req);
+void prepEnergy();
 void prepUarts();
+esp_err_t snifferSnapshot(httpd_req_t* req);
 void processMCUcmd();
-void processTuyaMsg(const char* wsMsg) ;
+void processTuyaMsg(const char* wsMsg, txDoneCB txDone = NULL, void* txArg = NULL);
+esp_err_t ruleHitsJson(httpd_req_t* req);
+void runConformance(const char* params);
+void runScript(const char* fileName);
+esp_err_t txLatencyJson(httpd_req_t* req);
+void simInject(const byte* frame, size_t frameLen);
+bool simReceive(byte* frame, size_t& frameLen, uint32_t waitMs, int64_t* sentUs = NULL);
+bool simulateMCU(bool simulate);
+void startWarp(const char* days);
 
 
 /******************** Global app declarations *******************/
 
 extern const char* appConfig;
 extern bool uartReady;
+extern bool foldFrames;
+extern bool captureOn;
+extern bool diffMode;
+extern bool logFrames;
+extern int uartRxBuff;
+extern int tapPort;
+extern int vuartSide;
+extern int vuartPort;
+extern int conformDeadline;
+extern int rxThresh[2];
+extern int rxTimeout[2];
 
 /************************** structures ********************************/
 
 struct tuyaStruct {
   uint8_t tuyaCmd;
   uint8_t tuyaDP;
+  uint8_t tuyaType;
+  uint16_t tuyaLen;
   int32_t tuyaInt;
   uint8_t tuyaData[200]; // bigger than max message size from tuya MCU
 };
+
+struct latencyStruct {
+  uint32_t bucket[LAT_BUCKETS]; // count per log2 ms bucket
+  uint32_t count;
+  uint32_t timeouts;
+  uint32_t dropped; // evicted unanswered as too many pending
+  uint32_t maxMs;
+};
 extern tuyaStruct mcuTuya;
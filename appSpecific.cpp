@@ -4,6 +4,8 @@
 // s60sc 2022
 
 #include "appGlobals.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
 
 const size_t prvtkey_len = 0;
 const size_t cacert_len = 0;
@@ -19,9 +21,12 @@ const char* cacert_pem = "";
 #define TGT_TEMP 4 // schedule column containing target temp
 #define SECS_COL 5 // schedule column containing seconds duration
 #define HB_INTERVAL 15 // interval in secs to sent heartbeat to MCU
+#define USAGE_HOURS 24 // hourly buckets for last 24 hours energy use
+#define SLOTS_PER_HOUR (SECS_IN_HOUR / HB_INTERVAL) // heartbeat intervals per hour
+#define FLASH_INTERVAL SECS_IN_HOUR // min secs between energy checkpoints to flash
+#define DP_QUERY_GAP 10 // min secs between cache refresh queries to MCU
 
 static bool gotHeartbeat = false;
-static uint32_t heatingElapsed = 0; // total time heating on since startup
 static float currentTemp = 15.0; // initial value for smoothing
 static float alpha = 1.0; // for exponential moving average filter
 static int drift = 3; // greater than floor sensor temperature fluctuations
@@ -34,22 +39,354 @@ static bool heatingOn = false;
 static int schedule[TIME_SLOTS][6];
 bool uartReady = false;
 static bool devHub = false;
+static int dpTTL = 300; // secs before cached DP value is refreshed from MCU
+
+/****************************** app clock ******************************/
+
+// App logic gets time from here rather than directly, so that during time warp simulation
+// a virtual clock is used, which advances by each delay, so simulated days take minutes.
+// A virtual delay then waits for the simulated MCU to have answered the heartbeat, 
+// rather than for a fixed real time, so that acks are not missed under load.
+
+#define WARP_STEP_MS 1000 // max real ms a virtual delay waits for simulated MCU
+
+static volatile bool warpActive = false;
+static TaskHandle_t warpHandle = NULL;
+static SemaphoreHandle_t warpStep = NULL; // given when simulated MCU has acked heartbeat
+static volatile uint32_t warpMs = 0; // virtual millis()
+static uint32_t warpStartMs = 0;
+static time_t warpStartEpoch = 0;
+
+static uint32_t appMillis() {
+  return warpActive ? warpMs : millis();
+}
+
+static void appTime(struct timeval* tv) {
+  if (!warpActive) gettimeofday(tv, NULL);
+  else {
+    uint32_t elapsedMs = warpMs - warpStartMs;
+    tv->tv_sec = warpStartEpoch + elapsedMs / 1000;
+    tv->tv_usec = (elapsedMs % 1000) * 1000;
+  }
+}
+
+static void appDelay(uint32_t ms) {
+  if (!warpActive) delay(ms);
+  else {
+    warpMs += ms;
+    if (xTaskGetCurrentTaskHandle() != warpHandle) xSemaphoreTake(warpStep, pdMS_TO_TICKS(WARP_STEP_MS));
+  }
+}
+
+static bool appTimeValid() {
+  return timeSynchronized || warpActive;
+}
+
+/**************************** energy counters ****************************/
+
+// Heating counters persist across restarts. Each heartbeat they are checkpointed to 
+// alternating CRC protected slots in RTC memory, which survives a software restart or 
+// crash but not power loss. Every FLASH_INTERVAL they are also checkpointed to NVS, 
+// alternating between two slots per flash write to spread wear and survive a torn write.
+// At startup the newest valid slot of the four is restored.
+
+struct energyStruct {
+  uint32_t seq; // checkpoint sequence, higher is newer
+  uint64_t heatingMs; // total time heating on
+  uint64_t monitorMs; // total time monitored
+  uint16_t usage[USAGE_HOURS]; // heartbeat intervals heating on per hour
+  uint16_t hourSlots; // heartbeat intervals recorded in current hour
+  uint8_t hourIdx; // current hour bucket
+  uint8_t cycled; // all hour buckets used
+  uint32_t flashWrites; // total checkpoints to flash
+  uint32_t crc; // must be last
+};
+static energyStruct energy;
+RTC_NOINIT_ATTR static energyStruct rtcEnergy[2];
+static Preferences energyPrefs;
+static bool energyRestored = false;
+static int flashToday = 0;
+static SemaphoreHandle_t energyMutex = NULL; // heartbeat and MCU tasks both accrue energy
+
+static uint32_t energyCrc(energyStruct& e) {
+  return esp_rom_crc32_le(0, (const uint8_t*)&e, offsetof(energyStruct, crc));
+}
+
+static void restoreEnergy() {
+  // load newest valid checkpoint from RTC or NVS slots
+  energyStruct saved[4];
+  memcpy(saved, rtcEnergy, sizeof(rtcEnergy));
+  memset(saved + 2, 0, sizeof(energyStruct) * 2);
+  if (energyPrefs.begin("energy", true)) {
+    energyPrefs.getBytes("slot0", saved + 2, sizeof(energyStruct));
+    energyPrefs.getBytes("slot1", saved + 3, sizeof(energyStruct));
+    energyPrefs.end();
+  }
+  int newest = -1;
+  for (int i = 0; i < 4; i++) {
+    if (saved[i].seq && saved[i].crc == energyCrc(saved[i])) {
+      if (newest < 0 || saved[i].seq > saved[newest].seq) newest = i;
+    }
+  }
+  if (newest >= 0) {
+    energy = saved[newest];
+    LOG_INF("Restored energy counters from %s, heating %llu of %llu secs", 
+      newest < 2 ? "RTC" : "NVS", energy.heatingMs / 1000, energy.monitorMs / 1000);
+  } else {
+    memset(&energy, 0, sizeof(energy));
+    LOG_INF("No saved energy counters, starting from zero");
+  }
+  energyRestored = true;
+}
+
+static uint32_t lastAccrue = 0; // time energy last accrued
+
+static void saveEnergy(bool toFlash) {
+  // checkpoint counters to alternate RTC slot, and to alternate NVS slot if requested
+  // RTC slot alternates per checkpoint, NVS slot per flash write
+  if (toFlash) energy.flashWrites++;
+  energy.seq++;
+  energy.crc = energyCrc(energy);
+  rtcEnergy[energy.seq & 1] = energy;
+  if (toFlash) {
+    if (energyPrefs.begin("energy", false)) {
+      energyPrefs.putBytes(energy.flashWrites & 1 ? "slot1" : "slot0", &energy, sizeof(energy));
+      energyPrefs.end();
+    } else LOG_WRN("Failed to checkpoint energy counters to NVS");
+  }
+}
+
+static void checkpointEnergy() {
+  // called on each heartbeat, only write to flash at interval, energyMutex held
+  if (warpActive) return; // simulated counters are not saved
+  static uint32_t lastFlash = millis();
+  static uint32_t dayStart = millis();
+  if (millis() - dayStart >= SECS_IN_DAY * 1000) {
+    dayStart = millis();
+    flashToday = 0;
+  }
+  bool toFlash = millis() - lastFlash >= FLASH_INTERVAL * 1000;
+  if (toFlash) {
+    lastFlash = millis();
+    flashToday++;
+  }
+  saveEnergy(toFlash);
+}
+
+static void accrueEnergy() {
+  // add time since previous call to monitored time, and to heating time if on, energyMutex held
+  if (!energyRestored) restoreEnergy();
+  if (!lastAccrue) lastAccrue = appMillis();
+  uint32_t elapsed = appMillis() - lastAccrue;
+  lastAccrue += elapsed;
+  energy.monitorMs += elapsed;
+  if (heatingOn) energy.heatingMs += elapsed;
+}
+
+void prepEnergy() {
+  energyMutex = xSemaphoreCreateMutex();
+}
+
+/****************************** DP shadow ******************************/
+
+// Last value reported by the MCU for each DP. The MCU re-reports unchanged values, 
+// eg all DPs after each status query, so only genuine changes are propagated.
+// The shadow also acts as the DP cache for browser reads, with a version number 
+// for each change and the time each DP was last reported to determine staleness
+
+#define MAX_DPS 24 // more than number of DPs used by device
+#define DP_VAL_LEN 32 // longest DP value (schedule)
+
+struct dpShadowStruct {
+  uint8_t dpId;
+  uint8_t dpType;
+  uint16_t dpLen;
+  int32_t intVal; // value if integer type
+  uint8_t dpVal[DP_VAL_LEN]; // value if other types
+  uint32_t version; // cache version when value last changed
+  uint32_t lastSeen; // appMillis() when last reported by MCU
+  bool resync; // propagate next report even if unchanged
+};
+static dpShadowStruct dpShadow[MAX_DPS];
+static int dpCount = 0;
+static uint32_t dpVersion = 0; // incremented on each DP value change
+static uint32_t dpPropagated = 0;
+static uint32_t dpSuppressed = 0;
+static uint32_t dpQueryMs = 0; // time of last cache refresh query
+static bool dpQueryPending = false; // refresh query not yet answered
+static uint32_t dpAnsweredMs = 0; // time of last answered refresh query, 0 if none
+
+static bool dpChanged() {
+  // compare latest DP report in mcuTuya with shadow, returns true if new or changed
+  int i = 0;
+  while (i < dpCount && dpShadow[i].dpId != mcuTuya.tuyaDP) i++;
+  if (i == MAX_DPS) return true; // table full, always propagate
+  dpShadowStruct& dp = dpShadow[i];
+  uint16_t valLen = min(mcuTuya.tuyaLen, (uint16_t)DP_VAL_LEN);
+  bool changed = i == dpCount || dp.resync || dp.dpType != mcuTuya.tuyaType || dp.dpLen != mcuTuya.tuyaLen;
+  if (!changed) changed = (dp.dpType == 2) ? dp.intVal != mcuTuya.tuyaInt : memcmp(dp.dpVal, mcuTuya.tuyaData, valLen);
+  if (changed) {
+    // update shadow
+    if (i == dpCount) dpCount++;
+    dp.dpId = mcuTuya.tuyaDP;
+    dp.dpType = mcuTuya.tuyaType;
+    dp.dpLen = mcuTuya.tuyaLen;
+    dp.intVal = mcuTuya.tuyaInt;
+    memcpy(dp.dpVal, mcuTuya.tuyaData, valLen);
+    dp.version = ++dpVersion;
+    dp.resync = false;
+  }
+  dp.lastSeen = appMillis();
+  if (dpQueryPending) {
+    // DPs absent from query response are as fresh as the query
+    dpAnsweredMs = dpQueryMs;
+    dpQueryPending = false;
+  }
+  return changed;
+}
+
+static uint32_t dpCacheAge() {
+  // age in ms of oldest cached DP value, or of last answered query if more recent
+  uint32_t oldest = 0;
+  for (int i = 0; i < dpCount; i++) oldest = max(oldest, appMillis() - dpShadow[i].lastSeen);
+  if (dpAnsweredMs) oldest = min(oldest, appMillis() - dpAnsweredMs);
+  return oldest;
+}
+
+static void checkDPcache() {
+  // browser reads are served from cache, MCU only queried if cache empty or any DP is stale
+  // tuya serial protocol has no single DP query, so refresh uses status query for all DPs
+  if (USE_SNIFFER || !uartReady) return;
+  uint32_t cacheAge = dpCacheAge();
+  if ((!dpCount || cacheAge > dpTTL * 1000) && appMillis() - dpQueryMs > DP_QUERY_GAP * 1000) {
+    LOG_VRB("DP cache stale by %lu secs, query MCU", cacheAge / 1000);
+    dpQueryMs = appMillis();
+    dpQueryPending = true;
+    processTuyaMsg("M 8"); // query datapoint status
+  }
+}
+
+/************************* DP write latency *************************/
+
+// Time from each DP write to the MCU until the MCU confirms it with a report of that DP, 
+// to detect an MCU that is slowing down or dropping writes
+
+#define DP_WRITE_TIMEOUT 2000 // ms to wait for report after write
+
+struct dpLatencyStruct {
+  uint8_t dpId;
+  int64_t sentUs; // time of unconfirmed write, 0 if none
+  latencyStruct latency;
+};
+static dpLatencyStruct dpLatency[MAX_DPS];
+static int dpLatencyCnt = 0;
+static portMUX_TYPE dpLatencyMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void checkWriteTimeout(dpLatencyStruct& dl, int64_t nowUs) {
+  // count write as timed out if no report in time, dpLatencyMux must be held
+  if (dl.sentUs && nowUs - dl.sentUs > DP_WRITE_TIMEOUT * 1000) {
+    dl.latency.timeouts++;
+    dl.sentUs = 0;
+  }
+}
+
+void dpWriteSent(uint8_t dpId) {
+  // called from uart writer task when DP write transmitted to MCU
+  // MCU may clamp or reject the value written, so always propagate its next report
+  for (int i = 0; i < dpCount; i++) if (dpShadow[i].dpId == dpId) dpShadow[i].resync = true;
+  int64_t nowUs = esp_timer_get_time();
+  portENTER_CRITICAL(&dpLatencyMux);
+  int i = 0;
+  while (i < dpLatencyCnt && dpLatency[i].dpId != dpId) i++;
+  if (i < MAX_DPS) {
+    if (i == dpLatencyCnt) {
+      memset(&dpLatency[i], 0, sizeof(dpLatencyStruct));
+      dpLatency[i].dpId = dpId;
+      dpLatencyCnt++;
+    } 
+    // previous write not yet confirmed counts as timeout
+    if (dpLatency[i].sentUs) dpLatency[i].latency.timeouts++;
+    dpLatency[i].sentUs = nowUs;
+  }
+  portEXIT_CRITICAL(&dpLatencyMux);
+}
+
+static void dpReported(uint8_t dpId) {
+  // DP report from MCU, confirms any pending write of this DP
+  int64_t nowUs = esp_timer_get_time();
+  portENTER_CRITICAL(&dpLatencyMux);
+  for (int i = 0; i < dpLatencyCnt; i++) {
+    dpLatencyStruct& dl = dpLatency[i];
+    if (dl.dpId == dpId) {
+      checkWriteTimeout(dl, nowUs);
+      if (dl.sentUs) latencyAdd(dl.latency, (nowUs - dl.sentUs) / 1000);
+      dl.sentUs = 0;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&dpLatencyMux);
+}
+
+static void checkDPtimeouts() {
+  // called on heartbeat to detect writes never confirmed
+  int64_t nowUs = esp_timer_get_time();
+  uint32_t timeouts = 0;
+  static uint32_t prevTimeouts = 0;
+  portENTER_CRITICAL(&dpLatencyMux);
+  for (int i = 0; i < dpLatencyCnt; i++) {
+    checkWriteTimeout(dpLatency[i], nowUs);
+    timeouts += dpLatency[i].latency.timeouts;
+  }
+  portEXIT_CRITICAL(&dpLatencyMux);
+  if (timeouts > prevTimeouts) LOG_WRN("MCU did not confirm %lu DP writes within %u ms", timeouts - prevTimeouts, DP_WRITE_TIMEOUT);
+  prevTimeouts = timeouts;
+}
+
+static esp_err_t dpLatencyJson(httpd_req_t* req) {
+  // return json of write to report latency per DP
+  dpLatencyStruct* latCopy = (dpLatencyStruct*)malloc(sizeof(dpLatency));
+  if (latCopy == NULL) return ESP_FAIL;
+  portENTER_CRITICAL(&dpLatencyMux);
+  int latCnt = dpLatencyCnt;
+  memcpy(latCopy, dpLatency, latCnt * sizeof(dpLatencyStruct));
+  portEXIT_CRITICAL(&dpLatencyMux);
+  char jsonItem[150];
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr_chunk(req, "{");
+  for (int i = 0; i < latCnt; i++) {
+    int keyLen = snprintf(jsonItem, sizeof(jsonItem), "%s\"%u\":", i ? "," : "", latCopy[i].dpId);
+    latencyJson(jsonItem + keyLen, sizeof(jsonItem) - keyLen, latCopy[i].latency);
+    httpd_resp_sendstr_chunk(req, jsonItem);
+  }
+  httpd_resp_sendstr_chunk(req, "}");
+  httpd_resp_sendstr_chunk(req, NULL);
+  free(latCopy);
+  return ESP_OK;
+}
 
 static void wsJsonSend(const char* keyStr, const char* valStr) {
   // output key val pair from MCU and send as json over websocket
   char jsondata[100];
   updateConfigVect(keyStr, valStr);
+  if (warpActive) return; // only simulation results are reported
   sprintf(jsondata, "{\"cfgGroup\":\"-1\", \"%s\":\"%s\"}", keyStr, valStr);
   logPrint("%s\n", jsondata);
 }
 
+void networkStatusData(byte* statusData) {
+  // set tuya network status, connected to cloud or not, as used for wifi icon
+  statusData[0] = (WiFi.status() == WL_CONNECTED) ? 4 : 0; 
+}
+
 static void sendWifiStatus(bool demanded) {
   // check if wifi status changed
   static int newWifiStatus = 0;
   static int oldWifiStatus = -1;
   char wifiStr[6] = "M 3 0";
   // set wifi icon on / off
-  newWifiStatus = (WiFi.status() == WL_CONNECTED) ? 4 : 0; 
+  byte statusData;
+  networkStatusData(&statusData);
+  newWifiStatus = statusData;
   if ((newWifiStatus != oldWifiStatus) || demanded) {
     wifiStr[4] = newWifiStatus + '0'; // convert to char
     oldWifiStatus = newWifiStatus;
@@ -57,52 +394,70 @@ static void sendWifiStatus(bool demanded) {
   }
 }
 
+void localTimeData(byte* timeData) {
+  // set 8 bytes of tuya local time data: flag, year, month, day, hour, minute, second, weekday
+  memset(timeData, 0, 8); // flag 0 if time not available
+  if (appTimeValid()) {
+    struct timeval tv;
+    struct tm timeinfo;
+    appTime(&tv);
+    localtime_r(&tv.tv_sec, &timeinfo);
+    timeData[0] = 1;
+    timeData[1] = timeinfo.tm_year % 100;
+    timeData[2] = timeinfo.tm_mon + 1;
+    timeData[3] = timeinfo.tm_mday;
+    timeData[4] = timeinfo.tm_hour;
+    timeData[5] = timeinfo.tm_min;
+    timeData[6] = timeinfo.tm_sec;
+    timeData[7] = timeinfo.tm_wday;
+  }
+}
+
 static void sendLocalTime(bool demanded) {
   // check if MCU has been sent local time
   static bool sentTime = false;
-  if ((timeSynchronized && !sentTime) || demanded) {
-    char currTime[30] = {"M 28 0 0 0 0 0 0 0 0"}; // time not available
-    if (timeSynchronized) {
-      // time available
-      struct timeval tv;
-      gettimeofday(&tv, NULL);
-      time_t currEpoch = tv.tv_sec;
-      strftime(currTime, 29, "M 28 1 %y %m %d %H %M %S %w", localtime(&currEpoch));
-      sentTime = true;
-    }
+  if ((appTimeValid() && !sentTime) || demanded) {
+    byte td[8];
+    localTimeData(td);
+    if (td[0]) sentTime = true;
+    char currTime[40];
+    sprintf(currTime, "M 28 %u %u %u %u %u %u %u %u", td[0], td[1], td[2], td[3], td[4], td[5], td[6], td[7]);
     processTuyaMsg(currTime);
   }
 }
 
 static int getDaily() {
-  static const uint16_t buffSize = (SECS_IN_HOUR / HB_INTERVAL) * 24; // 15 sec intervals in 24 hours
-  static bool usageBuff[buffSize] = {0};
-  static bool cycled = false;
-  static int buffPtr = 0;
-  // add entry to buffer
-  if (buffPtr >= buffSize) {
-    buffPtr = 0;
-    cycled = true;
-  } 
-  usageBuff[buffPtr++] = heatingOn;
+  // record heating state in hourly buckets, oldest bucket is reused after 24 hours
+  if (energy.hourSlots >= SLOTS_PER_HOUR) {
+    if (++energy.hourIdx >= USAGE_HOURS) {
+      energy.hourIdx = 0;
+      energy.cycled = true;
+    }
+    energy.usage[energy.hourIdx] = 0;
+    energy.hourSlots = 0;
+  }
+  energy.usage[energy.hourIdx] += heatingOn;
+  energy.hourSlots++;
   // calc number of 15 sec slots, extrapolate if less than 24 hours
   int usageCnt = 0;
-  int buffEnd = cycled ? buffSize : buffPtr;
-  for (int i=0; i<buffEnd; i++) usageCnt += usageBuff[i];
-  return usageCnt * buffSize / buffEnd; 
+  for (int i = 0; i < USAGE_HOURS; i++) usageCnt += energy.usage[i];
+  int slotCnt = (energy.cycled ? USAGE_HOURS - 1 : energy.hourIdx) * SLOTS_PER_HOUR + energy.hourSlots;
+  return usageCnt * SLOTS_PER_HOUR * USAGE_HOURS / slotCnt; 
 }
 
 static void updateStats() {
   // called on heartbeat to update stats
   // calculate uptime
   char timeBuff[20];
-  formatElapsedTime(timeBuff, millis());
+  formatElapsedTime(timeBuff, appMillis());
   updateConfigVect("upTime", timeBuff);
+  xSemaphoreTake(energyMutex, portMAX_DELAY);
+  accrueEnergy();
   // format heating time
-  formatElapsedTime(timeBuff, heatingElapsed);
+  formatElapsedTime(timeBuff, energy.heatingMs);
   updateConfigVect("totalOn", timeBuff);
   // calc percentage time on
-  float pcntOn = (float)(heatingElapsed) * 100.0 / millis();
+  float pcntOn = energy.monitorMs ? (float)(energy.heatingMs) * 100.0 / energy.monitorMs : 0;
   sprintf(timeBuff, "%0.1f%%", pcntOn); 
   updateConfigVect("pcntOn", timeBuff);
   // calc avg time on per day
@@ -117,16 +472,28 @@ static void updateStats() {
   float kwHday = KW * getDaily() * HB_INTERVAL / SECS_IN_HOUR;
   sprintf(timeBuff, "%0.1fkWh", kwHday);
   updateConfigVect("ahr24", timeBuff);
+  checkpointEnergy();
+  sprintf(timeBuff, "%d/%lu", flashToday, energy.flashWrites);
+  xSemaphoreGive(energyMutex);
+  updateConfigVect("flashWrites", timeBuff);
+  // DP reports propagated vs suppressed as unchanged
+  char dpBuff[30];
+  sprintf(dpBuff, "%lu/%lu", dpPropagated, dpSuppressed);
+  updateConfigVect("dpStats", dpBuff);
+  sprintf(dpBuff, "v%lu, %lu secs", dpVersion, dpCacheAge() / 1000);
+  updateConfigVect("dpCache", dpBuff);
 }
 
+static int schedSlot = -1; // current schedule slot, -1 to determine from time of day
+
 static void checkSchedule() {
   // check if time for next scheduled slot, assumes slots ordered by time
-  static int currentSlot = -1;
+  int& currentSlot = schedSlot;
   static int32_t slotDuration = 0;
   static uint32_t startTime = 0;
   static bool changedSlot = false;
 
-  if (!timeSynchronized) {
+  if (!appTimeValid()) {
 //    LOG_WRN("Unable to use ESP control as time not synchronised");
     // uses default temp for home setting
     return;
@@ -136,7 +503,7 @@ static void checkSchedule() {
     // use current time of day secs on first call to determine which slot to use
     struct timeval tv;
     struct tm timeinfo;
-    gettimeofday(&tv, NULL);
+    appTime(&tv);
     localtime_r(&tv.tv_sec, &timeinfo);
     int32_t currentSecs = (((timeinfo.tm_hour * 60) + timeinfo.tm_min) * 60) + timeinfo.tm_sec;
     // determine slot for current time
@@ -154,12 +521,14 @@ static void checkSchedule() {
       if (slotDuration < 0) slotDuration += SECS_IN_DAY; 
     } else slotDuration = schedule[currentSlot+1][SECS_COL] - currentSecs;
     slotDuration *= 1000;
+    startTime = appMillis();
     changedSlot = true;
 
   } else {
     // slot active, check if time for next slot
-    if (millis() - startTime > slotDuration) {
-      // set up duration of next slot
+    if (appMillis() - startTime > slotDuration) {
+      // set up duration of next slot, timed from end of previous slot to avoid cumulative drift
+      startTime += slotDuration;
       if (++currentSlot >= USED_SLOTS) currentSlot = 0;
       slotDuration = currentSlot < USED_SLOTS - 1 ? schedule[currentSlot+1][SECS_COL] : SECS_IN_DAY + schedule[0][SECS_COL]; 
       slotDuration = (slotDuration - schedule[currentSlot][SECS_COL]) * 1000;
@@ -170,10 +539,9 @@ static void checkSchedule() {
   if (changedSlot) {
     // send new target temp to MCU
     changedSlot = false;
-    startTime = millis();
     char formatted[10];
     sprintf(formatted, "%0.1f", (float)(schedule[currentSlot][TGT_TEMP] / 10.0));
-    LOG_INF("Activate schedule W%u: Temp %s for %u mins", currentSlot + 1, formatted, slotDuration / 1000 / 60);
+    if (!warpActive) LOG_INF("Activate schedule W%u: Temp %s for %u mins", currentSlot + 1, formatted, slotDuration / 1000 / 60);
     updateAppStatus("tgtTemp", formatted);    
   }
 }
@@ -189,9 +557,10 @@ void heartBeat() {
       sendWifiStatus(false);
       sendLocalTime(false);
       updateStats();
+      checkDPtimeouts();
       checkSchedule();
     } else LOG_WRN("Missed heartbeat");
-    delay(hbInterval * 1000);
+    appDelay(hbInterval * 1000);
   }
 }
 
@@ -222,7 +591,7 @@ static void controlHeating(float mcuTemp) {
     // heating on, switch off if target reached
     if (currentTemp > tgtTemp)  { 
       // force heating off by setting calibration to overstate floor temp   
-      LOG_INF("set OFF: current %0.1f, mcu %0.1f, floor %0.1f, calib %0.1f, target %0.1f", currentTemp, mcuTemp, floorTemp, baseCal + drift, tgtTemp); 
+      if (!warpActive) LOG_INF("set OFF: current %0.1f, mcu %0.1f, floor %0.1f, calib %0.1f, target %0.1f", currentTemp, mcuTemp, floorTemp, baseCal + drift, tgtTemp); 
       sprintf(formatted, "%ld", (int32_t)((baseCal + drift) * 10));
       updateAppStatus("espCal", formatted);
     }
@@ -230,7 +599,7 @@ static void controlHeating(float mcuTemp) {
     // heating off, switch on if dropped below target - backlash
     if (currentTemp + backLash < tgtTemp)  {
       // force heating on by setting calibration to understate floor temp    
-      LOG_INF("set ON: current + backlash %0.1f, mcu %0.1f, floor %0.1f, calib %0.1f, target %0.1f", currentTemp + backLash, mcuTemp, floorTemp, baseCal - drift, tgtTemp);     
+      if (!warpActive) LOG_INF("set ON: current + backlash %0.1f, mcu %0.1f, floor %0.1f, calib %0.1f, target %0.1f", currentTemp + backLash, mcuTemp, floorTemp, baseCal - drift, tgtTemp);     
       sprintf(formatted, "%ld", (int32_t)((baseCal - drift) * 10));
       updateAppStatus("espCal", formatted);
     }
@@ -242,6 +611,14 @@ static void processDP() {
   float floatTemp = (float)(mcuTuya.tuyaInt / 10.0); // where value is temperature * 10
   char formatted[MAX_PWD_LEN * 2];
   static uint32_t startTime = 0;
+  dpReported(mcuTuya.tuyaDP); // before suppression as write may not change value
+  // reset response and ESP control need every report, otherwise ignore unchanged values
+  bool alwaysDP = mcuTuya.tuyaDP == 31 || (mcuTuya.tuyaDP == 3 && ESPcontroller);
+  if (!dpChanged() && !alwaysDP) {
+    dpSuppressed++;
+    return;
+  }
+  dpPropagated++;
   switch (mcuTuya.tuyaDP) {
     case 1: // device display switched on / off
       sprintf(formatted, "%u", mcuTuya.tuyaData[0]);
@@ -272,12 +649,13 @@ static void processDP() {
     case 5: // heating output - 0 = not heating, 1 = output (heating) on 
       sprintf(formatted, "%u", mcuTuya.tuyaData[0]);
       wsJsonSend("outputOn", formatted);
+      xSemaphoreTake(energyMutex, portMAX_DELAY);
+      accrueEnergy(); // account time up to change of state
       heatingOn = (bool)mcuTuya.tuyaData[0];
-      if (heatingOn) startTime = millis();
+      xSemaphoreGive(energyMutex);
+      if (heatingOn) startTime = appMillis();
       if (!heatingOn && startTime > 0) {
-        // add this heating time to total
-        heatingElapsed += (millis() - startTime);   
-        LOG_INF("Heating session lasted %u secs", (millis() - startTime) / 1000);
+        if (!warpActive) LOG_INF("Heating session lasted %u secs", (appMillis() - startTime) / 1000);
         startTime = 0;      
       }
     break;
@@ -349,9 +727,9 @@ static void doTuyaInit() {
   initStatus(98, 100); // config group 98 is the DP settings
   if (ESPcontroller) processTuyaMsg("M 6 4 4 0"); // manual mode
   else processTuyaMsg("M 6 4 4 1"); // auto mode
-  delay(100);
+  appDelay(100);
   processTuyaMsg("M 8"); // get updated DPs
-  delay(100);
+  appDelay(100);
 }
 
 void processMCUcmd() {
@@ -366,16 +744,252 @@ void processMCUcmd() {
     case 2: break; // working mode query response - view only
     case 3: break; // wifi status ack
     case 4: break; // request wifi reset - ignore
+    case 28: // request for local time
+    case 43: // request network status
+    break; // answered by fast reply in frame parser
     case 7: // datapoint status response
       processDP();
     break;  
-    case 28: // request for local time
-      sendLocalTime(true);
-    break;
     default: LOG_ERR("Unhandled command number %u", mcuTuya.tuyaCmd);
   }
 }
 
+/************************ time warp simulation ************************/
+
+// Runs the controller on the virtual clock against a simulated MCU for a number of days, 
+// at thousands of times real speed. The simulated MCU acks heartbeats, reports DP writes
+// back, and models a room heated under MCU thermostat control to the target temperature.
+// Asserts that each schedule slot is activated with its temperature within two heartbeats 
+// of its start time, and that the energy counters match the modelled heating time.
+// Run with /control?warp=days, results are logged, then the energy counters are restored.
+
+#define WARP_MAX_DAYS 30
+#define WARP_TOLERANCE (HB_INTERVAL * 2 * 1000) // ms allowed for slot start and energy totals
+#define HEAT_RATE 1.0 // modelled deg C per hour rise when heating
+#define COOL_RATE 0.5 // modelled deg C per hour fall when not heating
+
+struct warpModelStruct {
+  float roomTemp;
+  int32_t tgtTemp; // deg C * 10
+  bool heating;
+  uint32_t lastMs; // virtual time of last model update
+  uint64_t heatingMs;
+  uint32_t transitions; // schedule slot activations
+  uint32_t slotErrors;
+};
+
+struct warpSavedStruct {
+  // real state overwritten during simulation
+  energyStruct energy;
+  bool heatingOn;
+  dpShadowStruct dpShadow[MAX_DPS];
+  int dpCount;
+  uint32_t dpPropagated;
+  uint32_t dpSuppressed;
+  dpLatencyStruct dpLatency[MAX_DPS];
+  int dpLatencyCnt;
+};
+
+static int warpDays = 0;
+static warpModelStruct warpModel;
+
+static void warpSave(warpSavedStruct* saved, bool restore) {
+  // save real state before simulation, or restore it afterwards
+  xSemaphoreTake(energyMutex, portMAX_DELAY);
+  if (!restore) {
+    if (!energyRestored) restoreEnergy();
+    saved->energy = energy;
+    saved->heatingOn = heatingOn;
+    memcpy(saved->dpShadow, dpShadow, sizeof(dpShadow));
+    saved->dpCount = dpCount;
+    saved->dpPropagated = dpPropagated;
+    saved->dpSuppressed = dpSuppressed;
+    portENTER_CRITICAL(&dpLatencyMux);
+    memcpy(saved->dpLatency, dpLatency, sizeof(dpLatency));
+    saved->dpLatencyCnt = dpLatencyCnt;
+    portEXIT_CRITICAL(&dpLatencyMux);
+  } else {
+    energy = saved->energy;
+    heatingOn = saved->heatingOn;
+    // app values were overwritten by simulated DPs, so next real report of each is propagated
+    memcpy(dpShadow, saved->dpShadow, sizeof(dpShadow));
+    dpCount = saved->dpCount;
+    for (int i = 0; i < dpCount; i++) dpShadow[i].resync = true;
+    dpPropagated = saved->dpPropagated;
+    dpSuppressed = saved->dpSuppressed;
+    portENTER_CRITICAL(&dpLatencyMux);
+    memcpy(dpLatency, saved->dpLatency, sizeof(dpLatency));
+    dpLatencyCnt = saved->dpLatencyCnt;
+    portEXIT_CRITICAL(&dpLatencyMux);
+    lastAccrue = millis();
+    schedSlot = -1;
+  }
+  xSemaphoreGive(energyMutex);
+}
+
+static void warpInject(byte* frame, size_t frameLen) {
+  // set checksum and inject frame from simulated MCU
+  frame[frameLen - 1] = 0;
+  for (size_t i = 0; i < frameLen - 1; i++) frame[frameLen - 1] += frame[i];
+  simInject(frame, frameLen);
+}
+
+static void warpReport(uint8_t dpId, uint8_t dpType, int32_t value) {
+  // report integer DP value from simulated MCU
+  uint8_t valLen = dpType == 2 ? 4 : 1;
+  byte frame[15] = {0x55, 0xaa, 0x03, 0x07, 0x00, (byte)(4 + valLen), dpId, dpType, 0x00, valLen};
+  for (int i = 0; i < valLen; i++) frame[10 + i] = (byte)(value >> (8 * (valLen - 1 - i)));
+  warpInject(frame, 11 + valLen);
+}
+
+static void warpThermostat() {
+  // update room temp for time since last update, then apply MCU thermostat with 0.5 deg backlash
+  uint32_t nowMs = appMillis();
+  uint32_t elapsedMs = nowMs - warpModel.lastMs;
+  warpModel.lastMs = nowMs;
+  if (warpModel.heating) warpModel.heatingMs += elapsedMs;
+  warpModel.roomTemp += (warpModel.heating ? HEAT_RATE : -COOL_RATE) * elapsedMs / MS_HR;
+  bool heating = warpModel.heating;
+  if (warpModel.roomTemp * 10 < warpModel.tgtTemp - 5) heating = true;
+  else if (warpModel.roomTemp * 10 > warpModel.tgtTemp) heating = false;
+  warpReport(3, 2, (int32_t)(warpModel.roomTemp * 10));
+  if (heating != warpModel.heating) {
+    warpModel.heating = heating;
+    warpReport(5, 1, heating);
+  }
+}
+
+static void warpSlotCheck(int32_t tgtValue) {
+  // check target temp write matches schedule slot for virtual time of day
+  struct timeval tv;
+  struct tm timeinfo;
+  appTime(&tv);
+  localtime_r(&tv.tv_sec, &timeinfo);
+  int32_t daySecs = (((timeinfo.tm_hour * 60) + timeinfo.tm_min) * 60) + timeinfo.tm_sec;
+  // slot in effect is latest slot started at or before now, else last slot of previous day
+  int slot = USED_SLOTS - 1;
+  while (slot >= 0 && schedule[slot][SECS_COL] > daySecs) slot--;
+  if (slot < 0) slot = USED_SLOTS - 1;
+  int32_t lateSecs = daySecs - schedule[slot][SECS_COL];
+  if (lateSecs < 0) lateSecs += SECS_IN_DAY;
+  bool firstSlot = !warpModel.transitions++;
+  // target temp is sent to MCU in whole degrees
+  if (tgtValue / 10 != schedule[slot][TGT_TEMP] / 10 || (!firstSlot && lateSecs * 1000 > WARP_TOLERANCE)) {
+    warpModel.slotErrors++;
+    LOG_WRN("Warp day %lu %02d:%02d:%02d target %ld, expected W%d %d, %ld secs after slot start", 
+      (tv.tv_sec - warpStartEpoch) / SECS_IN_DAY + 1, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, 
+      tgtValue, slot + 1, schedule[slot][TGT_TEMP], lateSecs);
+  }
+}
+
+static void warpTask(void* arg) {
+  // run simulation on virtual clock, then check results and restore real state
+  warpSavedStruct* saved = (warpSavedStruct*)malloc(sizeof(warpSavedStruct));
+  if (saved == NULL) {
+    LOG_ERR("Failed to allocate time warp state");
+    simulateMCU(false);
+    warpHandle = NULL;
+    vTaskDelete(NULL);
+  }
+  warpSave(saved, false);
+  energyStruct& savedEnergy = saved->energy;
+  memset(&warpModel, 0, sizeof(warpModel));
+  warpModel.roomTemp = 18.0;
+  warpModel.tgtTemp = tgtTemp * 10;
+  // virtual clock starts at local midnight on Mon 1 Jan 2024
+  struct tm startTm = {};
+  startTm.tm_year = 2024 - 1900;
+  startTm.tm_mday = 1;
+  startTm.tm_isdst = -1;
+  warpStartEpoch = mktime(&startTm);
+  warpStartMs = warpMs = millis();
+  warpModel.lastMs = warpMs;
+  xSemaphoreTake(energyMutex, portMAX_DELAY);
+  lastAccrue = warpMs;
+  xSemaphoreGive(energyMutex);
+  schedSlot = -1;
+  xSemaphoreTake(warpStep, 0);
+  logFrames = false; // per frame logging would limit simulation speed
+  warpActive = true;
+  uint32_t durationMs = warpDays * SECS_IN_DAY * 1000UL;
+  LOG_INF("Time warp simulation of %d days started", warpDays);
+
+  byte frame[BUFF_LEN];
+  size_t frameLen;
+  while (warpMs - warpStartMs < durationMs) {
+    // respond to frames written to simulated MCU
+    if (!simReceive(frame, frameLen, 100) || frameLen < 7) continue;
+    switch (frame[3]) {
+      case 0: { // heartbeat
+        byte hbAck[8] = {0x55, 0xaa, 0x03, 0x00, 0x00, 0x01, 0x01, 0x00};
+        warpInject(hbAck, sizeof(hbAck));
+        warpThermostat();
+        xSemaphoreGive(warpStep);
+      }
+      break;
+      case 6: // DP write, reported back as MCU does
+        if (frameLen >= 15 && frame[6] == 2) {
+          int32_t tgtValue = (frame[10] << 24) | (frame[11] << 16) | (frame[12] << 8) | frame[13];
+          warpSlotCheck(tgtValue);
+          warpModel.tgtTemp = tgtValue;
+        }
+        frame[2] = 0x03;
+        frame[3] = 0x07;
+        warpInject(frame, frameLen);
+      break;
+      case 8: // DP status query
+        warpReport(2, 2, warpModel.tgtTemp);
+        warpReport(3, 2, (int32_t)(warpModel.roomTemp * 10));
+        warpReport(5, 1, warpModel.heating);
+      break;
+      default: break; // no response needed
+    }
+  }
+  warpActive = false;
+  logFrames = true;
+  simulateMCU(false);
+
+  // assert results
+  uint32_t expectSlots = warpDays * USED_SLOTS + 1; // includes slot in effect at start
+  bool slotsOK = !warpModel.slotErrors && abs((int32_t)(warpModel.transitions - expectSlots)) <= 1;
+  int64_t heatingDiff = (int64_t)(energy.heatingMs - savedEnergy.heatingMs) - (int64_t)warpModel.heatingMs;
+  int64_t monitorDiff = (int64_t)(energy.monitorMs - savedEnergy.monitorMs) - (int64_t)durationMs;
+  bool energyOK = llabs(heatingDiff) <= WARP_TOLERANCE && llabs(monitorDiff) <= WARP_TOLERANCE;
+  LOG_INF("Warp schedule %s: %lu slot activations, expected %lu, %lu errors", slotsOK ? "PASS" : "FAIL",
+    warpModel.transitions, expectSlots, warpModel.slotErrors);
+  LOG_INF("Warp energy %s: heating %llu secs, modelled %llu secs, monitored diff %lld ms", energyOK ? "PASS" : "FAIL",
+    (energy.heatingMs - savedEnergy.heatingMs) / 1000, warpModel.heatingMs / 1000, monitorDiff);
+  LOG_INF("Time warp simulation %s", slotsOK && energyOK ? "PASSED" : "FAILED");
+
+  // restore real state and refresh DPs from MCU
+  warpSave(saved, true);
+  free(saved);
+  processTuyaMsg("M 8");
+  warpHandle = NULL;
+  vTaskDelete(NULL);
+}
+
+void startWarp(const char* days) {
+  // start time warp simulation in controller mode
+  if (USE_SNIFFER || !uartReady || warpHandle != NULL) {
+    LOG_WRN("Time warp only available in controller mode when not already running");
+    return;
+  }
+  for (int i = 1; i < USED_SLOTS; i++) {
+    if (schedule[i][SECS_COL] <= schedule[i - 1][SECS_COL]) {
+      LOG_WRN("Time warp needs schedule slot times in ascending order");
+      return;
+    }
+  }
+  warpDays = constrain(atoi(days), 1, WARP_MAX_DAYS);
+  if (warpStep == NULL) warpStep = xSemaphoreCreateBinary();
+  if (!simulateMCU(true)) {
+    LOG_WRN("Time warp not started as MCU already simulated");
+    return;
+  }
+  xTaskCreate(warpTask, "warpTask", 1024 * 4, NULL, 2, &warpHandle);
+}
+
 /************************ webServer callbacks *************************/
 
 bool updateAppStatus(const char* variable, const char* value, bool fromUser) {
@@ -384,6 +998,23 @@ bool updateAppStatus(const char* variable, const char* value, bool fromUser) {
      eg processTuyaMsg("M 6 4 4 1"); M = MCU, 6 = DP cmd, 4 = DP id, 4 = data type, 1 = data
   */
   bool res = true; 
+  // sniffer settings
+  if (!strcmp(variable, "foldFrames")) foldFrames = (bool)atoi(value);
+  else if (!strcmp(variable, "diffMode")) diffMode = (bool)atoi(value);
+  else if (!strcmp(variable, "uartRxBuff")) uartRxBuff = atoi(value); // uart settings applied on restart
+  else if (!strcmp(variable, "tapPort")) tapPort = atoi(value); // applied on restart
+  else if (!strcmp(variable, "vuartSide")) vuartSide = atoi(value); // applied on restart
+  else if (!strcmp(variable, "vuartPort")) vuartPort = atoi(value);
+  else if (!strcmp(variable, "conformDeadline")) conformDeadline = atoi(value);
+  else if (!strcmp(variable, "mcuRxThresh")) rxThresh[0] = atoi(value);
+  else if (!strcmp(variable, "wifiRxThresh")) rxThresh[1] = atoi(value);
+  else if (!strcmp(variable, "mcuRxTimeout")) rxTimeout[0] = atoi(value);
+  else if (!strcmp(variable, "wifiRxTimeout")) rxTimeout[1] = atoi(value);
+  else if (!strcmp(variable, "captureOn")) {
+    captureOn = (bool)atoi(value);
+    captureFlush();
+  }
+  
   if (!USE_SNIFFER) {
     static int slotCnt = 0;
     char formatted[MAX_PWD_LEN * 2] = "M 6 ";
@@ -449,6 +1080,7 @@ bool updateAppStatus(const char* variable, const char* value, bool fromUser) {
     if (!strcmp(variable, "devHub")) devHub = (bool)intVal; 
     else if (!strcmp(variable, "alpha")) alpha = fltVal;
     else if (!strcmp(variable, "drift")) drift = intVal;
+    else if (!strcmp(variable, "dpTTL")) dpTTL = intVal;
 
     if (slotCnt >= TIME_SLOTS * 2) {
       // send complete schedule to MCU
@@ -492,6 +1124,10 @@ void appSpecificWsHandler(const char* wsMsg) {
       // manual request MCU initialisation
       doTuyaInit();
     break;
+    case 'C': 
+      // browser sync, values served from DP cache, refreshed from MCU if stale
+      checkDPcache();
+    break;
     case 'K':
       // kill websocket connection
       killSocket();
@@ -504,6 +1140,9 @@ void buildAppJsonString(bool filter) {
   // build app specific part of json string for MCU status
   char* p = jsonBuff + 1;
   *p = 0;
+  // cache version lets browser detect DP values changed since it last loaded them
+  p += sprintf(p, "\"dpVersion\":\"%lu\",", dpVersion);
+  checkDPcache();
 }
 
 esp_err_t appSpecificWebHandler(httpd_req_t *req, const char* variable, const char* value) {
@@ -523,7 +1162,20 @@ esp_err_t appSpecificWebHandler(httpd_req_t *req, const char* variable, const ch
     httpd_resp_sendstr_chunk(req, numStr);  
     httpd_resp_sendstr_chunk(req, "°C</text></svg>");
     httpd_resp_sendstr_chunk(req, NULL);
-  } else return ESP_FAIL;
+  } else if (!strcmp(variable, "capture")) return captureDownload(req, value);
+  else if (!strcmp(variable, "pcapng")) return capturePcapng(req, value);
+  else if (!strcmp(variable, "captureQuery")) return captureQuery(req, value);
+  else if (!strcmp(variable, "snapshot")) return snifferSnapshot(req);
+  else if (!strcmp(variable, "script")) runScript(value);
+  else if (!strcmp(variable, "conform")) runConformance(value);
+  else if (!strcmp(variable, "warp")) startWarp(value);
+  else if (!strcmp(variable, "rules")) loadRules(value);
+  else if (!strcmp(variable, "ruleHits")) return ruleHitsJson(req);
+  else if (!strcmp(variable, "pairing")) return pairingJson(req);
+  else if (!strcmp(variable, "dpCatalogue")) return dpCatalogue(req, value);
+  else if (!strcmp(variable, "dpLatency")) return dpLatencyJson(req);
+  else if (!strcmp(variable, "txLatency")) return txLatencyJson(req);
+  else return ESP_FAIL;
   return ESP_OK;
 }
 
@@ -544,6 +1196,12 @@ void doAppPing() {}
 
 void OTAprereq() {
   stopPing();
+  captureFlush();
+  if (energyRestored) {
+    xSemaphoreTake(energyMutex, portMAX_DELAY);
+    saveEnergy(true);
+    xSemaphoreGive(energyMutex);
+  }
 }
 
 /************** default app configuration **************/
@@ -574,6 +1232,9 @@ currTemp~18.8~98~N~na
 daySetting~0~98~S:0:1:2~na
 doReset~0~98~c~na
 drift~3~98~N~na
+dpStats~0/0~2~D~DP updates propagated/suppressed
+flashWrites~0/0~2~D~Energy checkpoints to flash today/total
+dpCache~v0, 0 secs~2~D~DP cache version, oldest value age
 fault~0~98~N~na
 floorMax~21~98~N~na
 frost~0~98~C~na
@@ -613,4 +1274,18 @@ upTime~0~2~D~Elapsed time since restart
 wifiTimeoutSecs~30~0~N~WiFi connect timeout (secs)
 devHub~0~0~C~Show Device Hub tab
 usePing~1~0~C~Use ping
+dpTTL~300~0~N~Max age of cached DP values (secs)
+wsDropOldest~1~0~C~Drop oldest websocket msg when queue full
+foldFrames~1~0~C~Fold repeated sniffed frames
+captureOn~0~0~C~Record sniffed frames to compressed capture files
+diffMode~0~0~C~Only show sniffed DP value changes
+uartRxBuff~1024~0~N~UART RX buffer size (bytes)
+mcuRxThresh~0~0~N~MCU UART RX FIFO threshold (0 = auto)
+wifiRxThresh~0~0~N~Wifi UART RX FIFO threshold (0 = auto)
+mcuRxTimeout~0~0~N~MCU UART RX timeout chars (0 = auto)
+wifiRxTimeout~0~0~N~Wifi UART RX timeout chars (0 = auto)
+tapPort~0~0~N~TCP tap port for raw frame records (0 = off)
+vuartSide~0~0~S:None:MCU:Wifi~Side replaced by virtual UART over TCP
+vuartPort~7000~0~N~Virtual UART TCP port
+conformDeadline~100~0~N~Conformance response deadline (ms)
 )~";
@@ -392,40 +392,125 @@
 
         function clearLog() {
           if (window.confirm('This will delete all log entries. Are you sure ?')) { 
-            $('#appLog').innerHTML = "";
+            clearLogView();
             if (logType != 1) sendControl("resetLog", "1");
           }
         }
 
         async function getLog() {
           // request display of stored log file
-          const log = $('#appLog');
-          log.innerHTML = "";
+          clearLogView();
           loggingOn = (logType == 1) ? true : false; 
           if (logType != 1) {
             const requestURL = logType == 0 ? '/control?displayLog=1' : '/web?log.txt';
             const response = await fetch(encodeURI(requestURL));
             if (response.ok) {
               const logData = await response.text();
-              let start = 0;
-              const loadNextLine = () => {
-                const index = logData.indexOf("\n", start);
-                if (index !== -1) {
-                  log.innerHTML += colorise(logData.substring(start, index)) + '<br>';
-                  start = index + 1;
-                  // auto scroll log as loaded
-                  const bottom = 2 * baseFontSize;// 2 lines
-                  const pos = Math.abs(log.scrollHeight - log.clientHeight - log.scrollTop);
-                  if (pos < bottom) log.scrollTop = log.scrollHeight;
-                  // stop browser hanging while log is loaded
-                  setTimeout(loadNextLine, 1); 
-                } 
-              };
-              loadNextLine(); 
+              const lines = logData.split("\n");
+              lines.pop(); // incomplete final line
+              appendLog(lines);
             } else showAlert("getLog - " + response.status + ": " + response.statusText); 
           }
         }
 
+        /*********** virtualised log view ***********/
+
+        // Log lines are held in a capped ring. The log element contains a spacer sized for all 
+        // lines, over which only the visible lines are rendered. New lines are batched and
+        // rendered once per animation frame, so high message rates do not stall the page.
+
+        const LOG_MAX_LINES = 5000; // oldest lines discarded beyond this
+        let logLines = []; // ring of log line text
+        let logStart = 0; // ring index of oldest line
+        let logPending = []; // lines received since last render
+        let logFramePending = false;
+        let logLineHeight = 0;
+        let logSpacer = null;
+        let logRows = null;
+
+        function initLogView() {
+          const log = $('#appLog');
+          log.innerHTML = "";
+          log.style.position = 'relative';
+          logSpacer = document.createElement('div');
+          logRows = document.createElement('div');
+          logRows.style.position = 'absolute';
+          logRows.style.top = '0';
+          logRows.style.whiteSpace = 'pre';
+          log.append(logSpacer, logRows);
+          log.addEventListener('scroll', () => { if (!logFramePending) renderLog(false); });
+          // log has no height while its panel is hidden, so re-measure and render when shown
+          new ResizeObserver(() => {
+            if (!log.clientHeight) logLineHeight = 0; // hidden
+            else if (!logFramePending) {
+              const wasHidden = !logLineHeight;
+              logLineHeight = 0; // font size may also have changed
+              renderLog(wasHidden);
+            }
+          }).observe(log);
+        }
+
+        function clearLogView() {
+          if (logSpacer === null) initLogView();
+          logLines = [];
+          logStart = 0;
+          logPending = [];
+          renderLog(false);
+        }
+
+        function appendLog(lines) {
+          // queue lines for display on next animation frame
+          if (logSpacer === null) initLogView();
+          // split multi line messages so each row has the same height
+          for (const line of lines) {
+            for (const row of line.split(/\r?\n/)) if (row.length) logPending.push(row);
+          }
+          if (!logFramePending) {
+            logFramePending = true;
+            requestAnimationFrame(flushLog);
+          }
+        }
+
+        function flushLog() {
+          // add queued lines to ring, discarding oldest when full
+          logFramePending = false;
+          const log = $('#appLog');
+          // auto scroll new entries unless scroll bar is not at bottom
+          const atBottom = Math.abs(log.scrollHeight - log.clientHeight - log.scrollTop) < 2 * baseFontSize;
+          let discarded = 0;
+          for (const line of logPending) {
+            if (logLines.length < LOG_MAX_LINES) logLines.push(line);
+            else {
+              logLines[logStart] = line;
+              logStart = (logStart + 1) % LOG_MAX_LINES;
+              discarded++;
+            }
+          }
+          logPending = [];
+          // keep view on same lines if scrolled back
+          if (!atBottom && logLineHeight) log.scrollTop -= discarded * logLineHeight;
+          renderLog(atBottom);
+        }
+
+        function renderLog(toBottom) {
+          // only materialise lines within visible part of log 
+          const log = $('#appLog');
+          if (!logLineHeight) {
+            // measure once log is displayed
+            logRows.innerHTML = "X";
+            logLineHeight = logRows.offsetHeight;
+            if (!logLineHeight) return;
+          }
+          logSpacer.style.height = logLines.length * logLineHeight + 'px';
+          if (toBottom) log.scrollTop = log.scrollHeight;
+          const first = Math.max(0, Math.floor(log.scrollTop / logLineHeight) - 2);
+          const last = Math.min(logLines.length, Math.ceil((log.scrollTop + log.clientHeight) / logLineHeight) + 2);
+          let rowsHtml = "";
+          for (let i = first; i < last; i++) rowsHtml += colorise(logLines[(logStart + i) % logLines.length]) + '<br>';
+          logRows.style.top = first * logLineHeight + 'px';
+          logRows.innerHTML = rowsHtml;
+        }
+
         function checkTime(value) {
           // sync browser time with app
           const now = new Date();
@@ -553,12 +638,7 @@
             let logText = fromUser ? "[" + date.toLocaleTimeString() + " Web] " : "";
             logText += reqStr;
             // append to log display 
-            const log = $('#appLog');
-            log.innerHTML += colorise(logText) + '<br>';
-            // auto scroll new entry unless scroll bar is not at bottom
-            const bottom = 2 * baseFontSize;// 2 lines
-            const pos = Math.abs(log.scrollHeight - log.clientHeight - log.scrollTop);
-            if (pos < bottom) log.scrollTop = log.scrollHeight;
+            appendLog([logText]);
           }
           console.log("Info: " + reqStr);
         }
@@ -88,6 +88,7 @@
 #define USECS 1000000
 #define MAGIC_NUM 987654321
 #define MAX_FAIL 5
+#define LZSS_BLOCK (1024 * 2) // max bytes in independently compressed block
 
 // global mandatory app specific functions, in appSpecific.cpp 
 bool appDataFiles();
@@ -99,9 +100,12 @@ void appSpecificTelegramTask(void* p);
 void buildAppJsonString(bool filter);
 bool updateAppStatus(const char* variable, const char* value, bool fromUser = true);
 
+typedef bool (*jobFunc)(); // job executor function, returns success
+
 // global general utility functions in utils.cpp / utilsFS.cpp / peripherals.cpp    
 void buildJsonString(uint8_t filter);
 bool calcProgress(int progressVal, int totalVal, int percentReport, uint8_t &pcProgress);
+void cancelJob(const char* jobName = NULL);
 bool changeExtension(char* fileName, const char* newExt);
 bool checkAlarm();
 bool checkAuth(httpd_req_t* req);
@@ -129,7 +133,7 @@ esp_err_t fileHandler(httpd_req_t* req, bool download = false);
 void flush_log(bool andClose = false);
 char* fmtSize (uint64_t sizeVal);
 void forceCrash();
-void formatElapsedTime(char* timeStr, uint32_t timeVal, bool noDays = false);
+void formatElapsedTime(char* timeStr, uint64_t timeVal, bool noDays = false);
 void formatHex(const char* inData, size_t inLen);
 bool fsStartTransfer(const char* fileFolder);
 const char* getEncType(int ssidIndex);
@@ -141,6 +145,7 @@ float getNTCcelsius(uint16_t resistance, float oldTemp);
 void goToSleep(int wakeupPin, bool deepSleep);
 bool handleWebDav(httpd_req_t* rreq);
 void initStatus(int cfgGroup, int delayVal);
+bool jobCancelled();
 void killSocket(int skt = -99);
 void listBuff(const uint8_t* b, size_t len); 
 bool listDir(const char* fname, char* jsonBuff, size_t jsonBuffLen, const char* extension);
@@ -148,6 +153,8 @@ bool loadConfig();
 void logLine();
 void logPrint(const char *fmtStr, ...);
 void logSetup();
+size_t lzssCompress(const uint8_t* in, size_t inLen, uint8_t* out, size_t outMax);
+size_t lzssDecompress(const uint8_t* in, size_t inLen, uint8_t* out, size_t outMax);
 void OTAprereq();
 bool parseJson(int rxSize);
 bool prepI2C();
@@ -156,6 +163,7 @@ void prepSMTP();
 bool prepTelegram();
 void prepTemperature();
 void prepUpload();
+bool queueJob(const char* jobName, jobFunc func, uint8_t priority = 1, uint32_t deadline = 0);
 void reloadConfigs();
 float readInternalTemp();
 float readTemperature(bool isCelsius, bool onlyDS18 = false);
@@ -194,6 +202,7 @@ uint32_t usePeripheral(const byte pinNum, const uint32_t receivedData);
 esp_sleep_wakeup_cause_t wakeupResetReason();
 void wsAsyncSendBinary(uint8_t* data, size_t len);
 bool wsAsyncSendText(const char* wsData);
+const char* wsQueueStats();
 // mqtt.cpp
 void startMqttClient();  
 void stopMqttClient();  
@@ -243,6 +252,7 @@ extern char ipExtAddr[];
 extern bool doGetExtIP;
 extern bool usePing; // set to false if problems related to this issue occur: https://github.com/s60sc/ESP32-CAM_MJPEG2SD/issues/221
 extern bool wsLog;
+extern bool wsDropOldest;
 extern uint16_t sustainId;
 extern bool heartBeatDone;
 extern TaskHandle_t heartBeatHandle;
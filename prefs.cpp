@@ -325,6 +325,7 @@ void updateStatus(const char* variable, const char* _value, bool fromUser) {
   else if (!strcmp(variable, "responseTimeoutSecs")) responseTimeoutSecs = intVal;
   else if (!strcmp(variable, "wifiTimeoutSecs")) wifiTimeoutSecs = intVal;
   else if (!strcmp(variable, "usePing")) usePing = (bool)intVal;
+  else if (!strcmp(variable, "wsDropOldest")) wsDropOldest = (bool)intVal;
   else if (!strcmp(variable, "dbgVerbose")) {
     dbgVerbose = (intVal) ? true : false;
     Serial.setDebugOutput(dbgVerbose);
@@ -393,6 +394,7 @@ void buildJsonString(uint8_t filter) {
     p += sprintf(p, "\"extIP\":\"%s\",", extIP); 
     p += sprintf(p, "\"httpPort\":\"%u\",", HTTP_PORT); 
     p += sprintf(p, "\"httpsPort\":\"%u\",", HTTPS_PORT); 
+    p += sprintf(p, "\"wsStats\":\"%s\",", wsQueueStats()); 
     if (!filter) {
       // populate first part of json string from config vect
       for (const auto& row : configs) 
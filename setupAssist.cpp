@@ -63,8 +63,8 @@ bool checkDataFiles() {
   bool res = false;
   if (strlen(GITHUB_PATH)) {
     res = wgetFile(COMMON_JS_PATH); 
-    if (res) res = wgetFile(INDEX_PAGE_PATH); 
-    if (res) res = appDataFiles(); 
+    if (res && !jobCancelled()) res = wgetFile(INDEX_PAGE_PATH); 
+    if (res && !jobCancelled()) res = appDataFiles(); 
   } else res = true; // no download needed
   return res;
 }
@@ -35,10 +35,16 @@
 #error sniffer.cpp must be compiled with arduino-esp32 core v3.1.0 or higher
 #endif
 #include "driver/uart.h"
+#include "esp_timer.h"
 
 static uint8_t uOffset = 0;  // if UART0 not used for MCU connection e.g ESP32, then UART1 used for MCU and UART2 used for Wifi
 bool useIOextender = false;
 #define QUEUE_SIZE 50
+// Auto rx interrupt settings: a tuya frame is sent as a continuous burst, so a short idle 
+// timeout marks the end of each frame, with the fifo threshold only reached by long frames
+#define AUTO_RX_THRESH (UART_FIFO_LEN - 16) // margin for interrupt latency before fifo overflows
+#define AUTO_RX_TOUT 3 // char times idle to indicate end of frame
+#define MAX_RX_TOUT 126 // max timeout supported by driver
 
 static TaskHandle_t wifiHandle = NULL;
 static TaskHandle_t mcuHandle = NULL;
@@ -47,6 +53,24 @@ SemaphoreHandle_t writeMutex = NULL; // prevent Web monitor / heartbeat contenti
 static QueueHandle_t uartQueue[2];
 static uart_event_t uartEvent[2];
 tuyaStruct mcuTuya;
+int uartRxBuff = 1024; // size of uart driver rx ring buffer
+int rxThresh[2] = {0, 0}; // rx fifo full threshold per uart, 0 for auto
+int rxTimeout[2] = {0, 0}; // rx idle timeout in char times per uart, 0 for auto
+static uint32_t uartEvents[2][UART_EVENT_MAX]; // count of each error event type per uart
+static uint32_t uartLost[2][UART_EVENT_MAX]; // bytes of partial frames discarded after each event type
+
+// frame parser state for each direction, plus frames injected by simulated MCU
+#define SIM_PARSER 2
+static int tuyaIdx[3] = {0, 0, 0};
+static bool haveHdr[3] = {false, false, false};
+static uint16_t msgLen[3] = {BUFF_LEN - 10, BUFF_LEN - 10, BUFF_LEN - 10};
+static byte frameBuff[3][BUFF_LEN]; // data received from wifi and mcu
+static int64_t frameStartUs[3]; // estimated time of first byte of frame
+static int64_t prevByteUs[3]; // estimated time of previous byte
+static size_t passBytes[3]; // bytes of oversize frame still to forward unmodified when rules loaded
+static int64_t nextByteUs[2]; // estimated time of next byte to be read from each uart
+static size_t rxThreshUsed[2]; // rx fifo threshold applied to each uart
+static int rxToutUsed[2]; // rx timeout applied to each uart
 
 struct uartStruct {
   char uartId;
@@ -56,15 +80,17 @@ struct uartStruct {
   const char* destName;
 };
 static uartStruct uart[2];
+static const char* dpTypeStr[] = {"raw", "bool", "int", "str", "enum", "bmap"}; // by tuya DP type
+bool logFrames = true; // false to suppress per frame output, eg during time warp
 
-static void formatTuya(int uartNum, const byte* tuyaData, size_t tuyaDataLen, bool isProcessed) {
+static void formatTuya(int uartNum, const byte* tuyaData, size_t tuyaDataLen, bool isProcessed, int64_t gapUs = -1) {
   // format message for readability on web monitor and command processing 
   // only input data is processed and formatted, output is only formatted
   if (USE_SNIFFER) isProcessed = false; // no processing in sniffer mode
-  static const char* typeStr[] = {"raw", "bool", "int", "str", "enum", "bmap"};
   char formatted[BUFF_LEN] = {0, };
   bool DP = false;
-  sprintf(formatted, "%s > ", uart[uartNum].destName);
+  if (gapUs >= 0) sprintf(formatted, "[+%0.1f ms] %s > ", gapUs / 1000.0, uart[uartNum].destName);
+  else sprintf(formatted, "%s > ", uart[uartNum].destName);
   for (int i = 0; i < tuyaDataLen; i++) {
     if (i == 3) {
       // command number
@@ -73,6 +99,9 @@ static void formatTuya(int uartNum, const byte* tuyaData, size_t tuyaDataLen, bo
       if (isProcessed) {
         mcuTuya.tuyaCmd = tuyaData[3];
         mcuTuya.tuyaDP = tuyaData[6];
+        mcuTuya.tuyaType = tuyaData[7];
+        // length of DP value or of command data
+        mcuTuya.tuyaLen = DP ? (tuyaData[8] << 8) | tuyaData[9] : (tuyaData[4] << 8) | tuyaData[5];
       }
     }
     
@@ -80,7 +109,7 @@ static void formatTuya(int uartNum, const byte* tuyaData, size_t tuyaDataLen, bo
       // commands with datapoints
       if (i == 6) sprintf(formatted + strlen(formatted), "DP %d: ", tuyaData[6]); // datapoint id
       // data type
-      else if (i == 7) sprintf(formatted + strlen(formatted), "%s ", typeStr[tuyaData[7]]); 
+      else if (i == 7) sprintf(formatted + strlen(formatted), "%s ", tuyaData[7] <= 5 ? dpTypeStr[tuyaData[7]] : "?"); 
  
       // data content, format depends on data type
       else if (i == 10 && i < tuyaDataLen - 1) {
@@ -133,64 +162,1897 @@ static void formatTuya(int uartNum, const byte* tuyaData, size_t tuyaDataLen, bo
       }
     }
   }
-  LOG_INF("%s", formatted);
+  if (logFrames) LOG_INF("%s", formatted);
+}
+
+/*********************** sniffer frame handling ************************/
+
+// In steady state most sniffed frames are identical heartbeats or unchanged DP reports.
+// Identical consecutive frames in a direction are suppressed and replaced by a single 
+// summary line when the run ends, or periodically for a long run.
+
+#define FOLD_MAX_SECS 300 // max duration of a run before it is reported
+
+bool foldFrames = true;
+
+struct foldStruct {
+  byte lastFrame[BUFF_LEN]; // last frame output in this direction
+  size_t lastLen;
+  uint32_t repeats; // number of suppressed repeats of last frame
+  uint32_t runStart; // millis() when last frame output
+  uint32_t runEnd; // millis() of latest repeat
+};
+static foldStruct fold[2];
+
+static void endFold(int uartNum) {
+  // report run of repeated frames
+  foldStruct& f = fold[uartNum];
+  if (f.repeats) {
+    LOG_INF("%s > repeated %lu times over %0.1f s", uart[uartNum].destName, f.repeats, (f.runEnd - f.runStart) / 1000.0);
+    f.repeats = 0;
+    f.runStart = f.runEnd;
+  }
+}
+
+static bool foldFrame(int uartNum, const byte* tuyaData, size_t tuyaDataLen) {
+  // returns true if frame is a repeat of previous frame in same direction
+  foldStruct& f = fold[uartNum];
+  if (foldFrames && tuyaDataLen == f.lastLen && !memcmp(tuyaData, f.lastFrame, tuyaDataLen)) {
+    f.repeats++;
+    f.runEnd = millis();
+    if (f.runEnd - f.runStart > FOLD_MAX_SECS * 1000) endFold(uartNum);
+    return true;
+  }
+  // different frame, so end any run
+  endFold(uartNum);
+  memcpy(f.lastFrame, tuyaData, tuyaDataLen);
+  f.lastLen = tuyaDataLen;
+  f.runStart = millis();
+  return false;
+}
+
+/*************************** capture files ***************************/
+
+// All sniffed frames can be recorded to storage, each with a capture header.
+// Records are buffered into blocks of up to LZSS_BLOCK bytes which are compressed 
+// independently before being appended to the current capture file, so a fixed RAM
+// budget is used and a truncated file is still readable up to its last block.
+// Full blocks are queued for the job executor to write, so storage is not accessed
+// by the uart tasks, and a block is dropped if CAPTURE_PENDING blocks are already queued.
+// Capture files are rotated at CAPTURE_FILE_SIZE and the oldest deleted when storage is low.
+// Download decompresses on the fly unless the client accepts lzss encoding.
+// A side index file per capture file holds an entry per block with its time range 
+// and a bitmap of the DP ids present, so queries only read the blocks needed.
+
+#define CAPTURE_MAGIC 0x5443
+#define CAPTURE_FILE_SIZE (1024 * 32) // start new capture file when exceeded
+#define CAPTURE_MIN_FREE (1024 * 64) // delete oldest capture file when free space is less
+#define CAPTURE_FLUSH_SECS 60 // max time records held in RAM before being written
+#define CAPTURE_PENDING 2 // max blocks queued for writing
+
+bool captureOn = false;
+
+struct captureHdr {
+  // precedes each frame in block
+  uint32_t secs; // time of frame completion
+  uint32_t usecs;
+  uint16_t frameLen;
+  uint8_t dir; // 1 from MCU, 0 from Wifi
+  uint8_t spare;
+};
+
+struct blockHdr {
+  // precedes each block in capture file
+  uint16_t magic;
+  uint16_t rawLen; // length of records
+  uint16_t storedLen; // length in file, same as rawLen if not compressible
+};
+
+struct indexEntry {
+  // side index entry per capture block
+  uint32_t firstSecs; // time of first record in block
+  uint32_t lastSecs;
+  uint32_t offset; // of block in capture file
+  uint32_t dpMask[8]; // bitmap of DP ids present in block
+};
+
+struct captureBlock {
+  // block of records queued for writing
+  uint8_t* records;
+  size_t len;
+  indexEntry index;
+};
+
+static SemaphoreHandle_t captureMutex = NULL; // guards accumulating and queued blocks
+static SemaphoreHandle_t captureWriteMutex = NULL; // guards capture file writes
+static uint8_t* captureBuff = NULL; // records being accumulated
+static uint8_t* storeBuff = NULL; // compressed block
+static captureBlock captureBlocks[CAPTURE_PENDING]; // queued blocks first, then free buffers
+static int pendingBlocks = 0;
+static uint32_t captureDropped = 0;
+static size_t captureLen = 0;
+static uint32_t blockStart = 0;
+static char captureFile[FILE_NAME_LEN] = {0};
+static size_t captureFileSize = 0;
+static uint32_t captureRaw = 0; // record bytes captured
+static uint32_t captureStored = 0; // bytes written to capture files
+static indexEntry blockIndex; // for block being accumulated
+
+static void markDPs(uint32_t* dpMask, const byte* tuyaData, size_t tuyaDataLen) {
+  // set bit in mask for each DP id in frame
+  if (tuyaDataLen < 11 || (tuyaData[3] != 6 && tuyaData[3] != 7)) return;
+  for (size_t pos = 6; pos + 4 <= tuyaDataLen - 1; pos += 4 + ((tuyaData[pos + 2] << 8) | tuyaData[pos + 3])) 
+    dpMask[tuyaData[pos] >> 5] |= 1UL << (tuyaData[pos] & 31);
+}
+
+static void indexPath(char* idxPath, const char* capPath) {
+  // side index file name for capture file
+  strcpy(idxPath, capPath);
+  changeExtension(idxPath, IDX_EXT);
+}
+
+static int captureSeq(bool oldest) {
+  // get lowest or highest capture file number, 0 if none
+  int seq = 0;
+  File root = STORAGE.open(CAPTURE_DIR);
+  if (root) {
+    File file = root.openNextFile();
+    while (file) {
+      int fileNum = atoi(file.name() + 3); // skip "cap"
+      if (fileNum && (!seq || (oldest ? fileNum < seq : fileNum > seq))) seq = fileNum;
+      file = root.openNextFile();
+    }
+  }
+  return seq;
+}
+
+static void newCaptureFile() {
+  // start next capture file in sequence
+  if (*captureFile) LOG_INF("Closed capture file %s, compression %0.1f:1", captureFile, 
+    captureStored ? (float)captureRaw / captureStored : 1.0);
+  else STORAGE.mkdir(CAPTURE_DIR);
+  snprintf(captureFile, FILE_NAME_LEN, "%s/cap%05d%s", CAPTURE_DIR, captureSeq(false) + 1, LZS_EXT);
+  captureFileSize = 0;
+}
+
+static void writeBlock(const captureBlock& block) {
+  // compress block of records and append to capture file, captureWriteMutex must be held
+  blockHdr hdr = {CAPTURE_MAGIC, (uint16_t)block.len, 0};
+  hdr.storedLen = lzssCompress(block.records, block.len, storeBuff, LZSS_BLOCK);
+  const uint8_t* blockData = storeBuff;
+  if (!hdr.storedLen) {
+    // store uncompressed
+    hdr.storedLen = block.len;
+    blockData = block.records;
+  }
+  if (!*captureFile || captureFileSize >= CAPTURE_FILE_SIZE) newCaptureFile();
+  char idxFile[FILE_NAME_LEN];
+  // make space by deleting oldest capture files, but not current file
+  while (STORAGE.totalBytes() - STORAGE.usedBytes() < CAPTURE_MIN_FREE) {
+    char oldestFile[FILE_NAME_LEN];
+    snprintf(oldestFile, FILE_NAME_LEN, "%s/cap%05d%s", CAPTURE_DIR, captureSeq(true), LZS_EXT);
+    if (!strcmp(oldestFile, captureFile) || !STORAGE.remove(oldestFile)) break;
+    indexPath(idxFile, oldestFile);
+    STORAGE.remove(idxFile);
+    LOG_INF("Deleted oldest capture file %s", oldestFile);
+  }
+  File cf = STORAGE.open(captureFile, FILE_APPEND);
+  if (cf) {
+    size_t wrote = cf.write((uint8_t*)&hdr, sizeof(hdr));
+    wrote += cf.write(blockData, hdr.storedLen);
+    cf.close();
+    if (wrote != sizeof(hdr) + hdr.storedLen) LOG_WRN("Capture file %s incomplete write", captureFile);
+    else {
+      // add block to side index
+      indexEntry entry = block.index;
+      entry.offset = captureFileSize;
+      indexPath(idxFile, captureFile);
+      File xf = STORAGE.open(idxFile, FILE_APPEND);
+      if (xf) {
+        xf.write((uint8_t*)&entry, sizeof(entry));
+        xf.close();
+      }
+    }
+    captureFileSize += wrote;
+    captureStored += wrote;
+  } else LOG_WRN("Failed to open capture file %s", captureFile);
+  captureRaw += block.len;
+}
+
+static void writePending() {
+  // write out queued blocks in order, each released for reuse once written
+  xSemaphoreTake(captureWriteMutex, portMAX_DELAY);
+  while (true) {
+    xSemaphoreTake(captureMutex, portMAX_DELAY);
+    if (!pendingBlocks) {
+      xSemaphoreGive(captureMutex);
+      break;
+    }
+    captureBlock block = captureBlocks[0]; // not changed by captureFrame while pending
+    xSemaphoreGive(captureMutex);
+    writeBlock(block);
+    xSemaphoreTake(captureMutex, portMAX_DELAY);
+    memmove(captureBlocks, captureBlocks + 1, (CAPTURE_PENDING - 1) * sizeof(captureBlock));
+    captureBlocks[CAPTURE_PENDING - 1] = block; // buffer free for reuse
+    pendingBlocks--;
+    xSemaphoreGive(captureMutex);
+  }
+  xSemaphoreGive(captureWriteMutex);
+}
+
+static bool captureJob() {
+  writePending();
+  return true;
+}
+
+static void queueBlock() {
+  // pass records accumulated so far to job executor for writing, captureMutex must be held
+  if (!captureLen) return;
+  if (pendingBlocks == CAPTURE_PENDING) {
+    captureDropped++;
+    LOG_WRN("Capture block dropped as storage writes behind, total %lu", captureDropped);
+  } else {
+    // swap accumulating buffer with free pending buffer
+    captureBlock& block = captureBlocks[pendingBlocks++];
+    uint8_t* freeBuff = block.records;
+    block.records = captureBuff;
+    block.len = captureLen;
+    block.index = blockIndex;
+    captureBuff = freeBuff;
+  }
+  captureLen = 0;
+}
+
+static bool allocCapture() {
+  // allocate capture buffers on first use, captureMutex must be held
+  if (captureBuff != NULL) return true;
+  captureBuff = (uint8_t*)malloc(LZSS_BLOCK);
+  storeBuff = (uint8_t*)malloc(LZSS_BLOCK);
+  bool allocated = captureBuff != NULL && storeBuff != NULL;
+  for (auto& block : captureBlocks) {
+    block.records = (uint8_t*)malloc(LZSS_BLOCK);
+    if (block.records == NULL) allocated = false;
+  }
+  if (!allocated) {
+    free(captureBuff);
+    free(storeBuff);
+    for (auto& block : captureBlocks) free(block.records);
+    captureBuff = storeBuff = NULL;
+    memset(captureBlocks, 0, sizeof(captureBlocks));
+    LOG_ERR("Failed to allocate capture buffers");
+  }
+  return allocated;
+}
+
+static void captureFrame(int uartNum, const byte* tuyaData, size_t tuyaDataLen) {
+  // add frame to capture block, queue block for writing when full or held too long
+  if (!captureOn || captureMutex == NULL) return;
+  size_t recLen = sizeof(captureHdr) + tuyaDataLen;
+  xSemaphoreTake(captureMutex, portMAX_DELAY);
+  if (!allocCapture()) {
+    captureOn = false;
+    xSemaphoreGive(captureMutex);
+    return;
+  }
+  if (captureLen + recLen > LZSS_BLOCK || millis() - blockStart > CAPTURE_FLUSH_SECS * 1000) queueBlock();
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  if (!captureLen) {
+    blockStart = millis();
+    memset(&blockIndex, 0, sizeof(blockIndex));
+    blockIndex.firstSecs = tv.tv_sec;
+  }
+  blockIndex.lastSecs = tv.tv_sec;
+  markDPs(blockIndex.dpMask, tuyaData, tuyaDataLen);
+  captureHdr hdr = {(uint32_t)tv.tv_sec, (uint32_t)tv.tv_usec, (uint16_t)tuyaDataLen, (uint8_t)uartNum, 0};
+  memcpy(captureBuff + captureLen, &hdr, sizeof(hdr));
+  memcpy(captureBuff + captureLen + sizeof(hdr), tuyaData, tuyaDataLen);
+  captureLen += recLen;
+  bool pending = pendingBlocks > 0;
+  xSemaphoreGive(captureMutex);
+  // storage written by job executor, off the uart path, requeued if job already finishing
+  if (pending) queueJob("captureWrite", captureJob, JOB_PRI);
+}
+
+static void prepCapture() {
+  captureMutex = xSemaphoreCreateMutex();
+  captureWriteMutex = xSemaphoreCreateMutex();
+}
+
+void captureFlush() {
+  // write out any buffered records
+  if (captureMutex == NULL) return;
+  xSemaphoreTake(captureMutex, portMAX_DELAY);
+  queueBlock();
+  xSemaphoreGive(captureMutex);
+  writePending();
+}
+
+static size_t readCaptureBlock(File& cf, const char* filePath, uint8_t* inBuff, uint8_t* outBuff, const uint8_t*& records) {
+  // read next block from capture file and expand if needed, returns length of records, 0 at end
+  blockHdr hdr;
+  while (cf.read((uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr)) {
+    if (hdr.magic != CAPTURE_MAGIC || hdr.storedLen > LZSS_BLOCK || hdr.rawLen > LZSS_BLOCK
+      || cf.read(inBuff, hdr.storedLen) != hdr.storedLen) {
+      LOG_WRN("Capture file %s has corrupt block at %u", filePath, cf.position());
+      return 0;
+    }
+    records = inBuff;
+    if (hdr.storedLen == hdr.rawLen) return hdr.rawLen;
+    records = outBuff;
+    if (lzssDecompress(inBuff, hdr.storedLen, outBuff, LZSS_BLOCK) == hdr.rawLen) return hdr.rawLen;
+    LOG_WRN("Capture file %s block at %u failed to expand", filePath, cf.position());
+  }
+  return 0;
+}
+
+esp_err_t captureDownload(httpd_req_t* req, const char* fileName) {
+  // download capture file, decompressed unless client accepts lzss encoding
+  char filePath[FILE_NAME_LEN];
+  if (strchr(fileName, '/') != NULL) return ESP_FAIL;
+  snprintf(filePath, FILE_NAME_LEN, "%s/%s", CAPTURE_DIR, fileName);
+  captureFlush();
+  File cf = STORAGE.open(filePath, FILE_READ);
+  if (!cf) {
+    LOG_WRN("Capture file %s not found", filePath);
+    httpd_resp_send_404(req);
+    return ESP_OK;
+  }
+  char acceptEnc[IN_FILE_NAME_LEN] = {0};
+  bool asStored = extractHeaderVal(req, "Accept-Encoding", acceptEnc) == ESP_OK && strstr(acceptEnc, "lzss") != NULL;
+  char contentDisp[FILE_NAME_LEN + 30];
+  snprintf(contentDisp, sizeof(contentDisp), "attachment; filename=%s", fileName);
+  if (!asStored) changeExtension(contentDisp, CAP_EXT);
+  httpd_resp_set_type(req, "application/octet-stream");
+  httpd_resp_set_hdr(req, "Content-Disposition", contentDisp);
+  LOG_INF("Download capture file %s %s", filePath, asStored ? "compressed" : "expanded");
+  if (asStored) {
+    httpd_resp_set_hdr(req, "Content-Encoding", "lzss");
+    return sendChunks(cf, req);
+  }
+  // expand each block in turn
+  esp_err_t res = ESP_OK;
+  uint8_t* inBuff = (uint8_t*)malloc(LZSS_BLOCK);
+  uint8_t* outBuff = (uint8_t*)malloc(LZSS_BLOCK);
+  if (inBuff == NULL || outBuff == NULL) {
+    LOG_ERR("Failed to allocate capture download buffers");
+    res = ESP_FAIL;
+  }
+  const uint8_t* records;
+  size_t recordsLen;
+  while (res == ESP_OK && (recordsLen = readCaptureBlock(cf, filePath, inBuff, outBuff, records)))
+    res = httpd_resp_send_chunk(req, (const char*)records, recordsLen);
+  cf.close();
+  free(inBuff);
+  free(outBuff);
+  httpd_resp_sendstr_chunk(req, NULL);
+  return res;
+}
+
+// Capture records are either converted to pcapng as streamed, or returned as json for a 
+// query, one block at a time. For pcapng there is an interface per direction using link 
+// type USER0 for the raw tuya frame bytes. Timestamps have nanosecond resolution, though 
+// captured to microseconds. When filtered by time and DP, the side index of each capture
+// file is used to read only the blocks that can contain matching records.
+
+#define PCAP_LINKTYPE 147 // LINKTYPE_USER0
+#define SEND_BUFF_LEN 1024 // output accumulated before sending
+
+struct captureFilter {
+  uint32_t fromSecs;
+  uint32_t toSecs;
+  int dpId; // -1 for any
+};
+
+static bool parseFilter(const char* filterStr, captureFilter& filter) {
+  // filter format is: from_epoch_secs,to_epoch_secs[,dp_id]
+  filter.dpId = -1;
+  if (sscanf(filterStr, "%lu,%lu,%d", &filter.fromSecs, &filter.toSecs, &filter.dpId) < 2) return false;
+  return filter.dpId >= -1 && filter.dpId <= 255;
+}
+
+static size_t pcapOption(uint8_t* out, uint16_t code, const void* value, uint16_t valLen) {
+  // append option padded to 32 bits, return length
+  memcpy(out, &code, 2);
+  memcpy(out + 2, &valLen, 2);
+  memcpy(out + 4, value, valLen);
+  size_t padLen = (valLen + 3) & ~3;
+  memset(out + 4 + valLen, 0, padLen - valLen);
+  return 4 + padLen;
+}
+
+static size_t pcapHeader(uint8_t* out) {
+  // section header block and interface description block per direction
+  uint32_t shb[7] = {0x0A0D0D0A, 28, 0x1A2B3C4D, 0x00000001, 0xFFFFFFFF, 0xFFFFFFFF, 28};
+  memcpy(out, shb, sizeof(shb));
+  size_t outLen = sizeof(shb);
+  for (int dir = 0; dir < 2; dir++) {
+    uint8_t* idb = out + outLen;
+    uint32_t idbHdr[4] = {0x00000001, 0, PCAP_LINKTYPE, 0}; // type, length, linktype + reserved, snaplen
+    memcpy(idb, idbHdr, sizeof(idbHdr));
+    size_t idbLen = sizeof(idbHdr);
+    char ifName[16];
+    snprintf(ifName, sizeof(ifName), "to %s", uart[dir].uartName);
+    idbLen += pcapOption(idb + idbLen, 2, ifName, strlen(ifName)); // if_name
+    uint8_t tsResol = 9; // nanoseconds
+    idbLen += pcapOption(idb + idbLen, 9, &tsResol, 1); // if_tsresol
+    idbLen += pcapOption(idb + idbLen, 0, NULL, 0); // opt_endofopt
+    idbLen += 4;
+    memcpy(idb + 4, &idbLen, 4);
+    memcpy(idb + idbLen - 4, &idbLen, 4);
+    outLen += idbLen;
+  }
+  return outLen;
+}
+
+static size_t pcapRecord(uint8_t* out, const captureHdr& rec, const uint8_t* frame) {
+  // enhanced packet block for record, return length
+  uint32_t blockLen = 32 + ((rec.frameLen + 3) & ~3);
+  uint64_t tsNs = (uint64_t)rec.secs * 1000000000ULL + (uint64_t)rec.usecs * 1000;
+  uint32_t epb[7] = {0x00000006, blockLen, rec.dir, (uint32_t)(tsNs >> 32), (uint32_t)tsNs, rec.frameLen, rec.frameLen};
+  memcpy(out, epb, sizeof(epb));
+  memcpy(out + sizeof(epb), frame, rec.frameLen);
+  memset(out + sizeof(epb) + rec.frameLen, 0, blockLen - 32 - rec.frameLen);
+  memcpy(out + blockLen - 4, &blockLen, 4);
+  return blockLen;
+}
+
+static size_t jsonRecord(char* out, const captureHdr& rec, const uint8_t* frame, bool first) {
+  // json object for record, return length
+  int outLen = sprintf(out, "%s{\"secs\":%lu,\"usecs\":%lu,\"dest\":\"%s\",\"frame\":\"", first ? "" : ",", 
+    rec.secs, rec.usecs, uart[rec.dir & 0x01].uartName);
+  for (int i = 0; i < rec.frameLen; i++) outLen += sprintf(out + outLen, "%02x", frame[i]);
+  return outLen + sprintf(out + outLen, "\"}");
+}
+
+static bool recordMatches(const captureFilter* filter, const captureHdr& rec, const uint8_t* frame) {
+  if (filter == NULL) return true;
+  if (rec.secs < filter->fromSecs || rec.secs > filter->toSecs) return false;
+  if (filter->dpId < 0) return true;
+  uint32_t dpMask[8] = {0};
+  markDPs(dpMask, frame, rec.frameLen);
+  return dpMask[filter->dpId >> 5] & (1UL << (filter->dpId & 31));
+}
+
+static bool nextIndexed(File& cf, File& xf, const captureFilter* filter) {
+  // seek to next block that may hold records matching filter, using side index
+  indexEntry entry;
+  while (xf.read((uint8_t*)&entry, sizeof(entry)) == sizeof(entry)) {
+    if (entry.firstSecs > filter->toSecs) return false; // entries in time order
+    if (entry.lastSecs < filter->fromSecs) continue;
+    if (filter->dpId >= 0 && !(entry.dpMask[filter->dpId >> 5] & (1UL << (filter->dpId & 31)))) continue;
+    return cf.seek(entry.offset);
+  }
+  return false;
+}
+
+static esp_err_t scanFile(httpd_req_t* req, const char* filePath, const captureFilter* filter, bool asPcap, 
+  uint8_t* inBuff, uint8_t* outBuff, uint8_t* sendBuff, uint32_t& matched) {
+  // output records in capture file that match filter as pcapng or json
+  esp_err_t res = ESP_OK;
+  File xf;
+  if (filter != NULL) {
+    char idxPath[FILE_NAME_LEN];
+    indexPath(idxPath, filePath);
+    xf = STORAGE.open(idxPath, FILE_READ);
+    if (xf && xf.size() >= sizeof(indexEntry)) {
+      // skip whole file if ended before time range
+      indexEntry lastEntry;
+      xf.seek(xf.size() - xf.size() % sizeof(indexEntry) - sizeof(indexEntry));
+      xf.read((uint8_t*)&lastEntry, sizeof(lastEntry));
+      xf.seek(0);
+      if (lastEntry.lastSecs < filter->fromSecs) {
+        xf.close();
+        return res;
+      }
+    } else if (xf) xf.close(); // empty index so scan whole file
+    // else no index so scan whole file
+  }
+  File cf = STORAGE.open(filePath, FILE_READ);
+  if (!cf) return res;
+  const uint8_t* records;
+  size_t recordsLen;
+  size_t sendLen = 0;
+  while (res == ESP_OK) {
+    if (xf && !nextIndexed(cf, xf, filter)) break;
+    if (!(recordsLen = readCaptureBlock(cf, filePath, inBuff, outBuff, records))) break;
+    for (size_t pos = 0; pos + sizeof(captureHdr) <= recordsLen && res == ESP_OK; ) {
+      captureHdr rec;
+      memcpy(&rec, records + pos, sizeof(rec));
+      pos += sizeof(rec);
+      if (pos + rec.frameLen > recordsLen) break;
+      const uint8_t* frame = records + pos;
+      pos += rec.frameLen;
+      if (!recordMatches(filter, rec, frame)) continue;
+      // max output for record
+      size_t recLen = asPcap ? 32 + rec.frameLen + 3 : 80 + rec.frameLen * 2;
+      if (sendLen + recLen > SEND_BUFF_LEN) {
+        res = httpd_resp_send_chunk(req, (const char*)sendBuff, sendLen);
+        sendLen = 0;
+      }
+      if (asPcap) sendLen += pcapRecord(sendBuff + sendLen, rec, frame);
+      else sendLen += jsonRecord((char*)sendBuff + sendLen, rec, frame, !matched);
+      matched++;
+    }
+  }
+  cf.close();
+  if (xf) xf.close();
+  if (res == ESP_OK && sendLen) res = httpd_resp_send_chunk(req, (const char*)sendBuff, sendLen);
+  return res;
+}
+
+static esp_err_t scanCaptures(httpd_req_t* req, const char* fileName, const captureFilter* filter, bool asPcap) {
+  // output given capture file, or all capture files oldest first, as pcapng or json
+  captureFlush();
+  uint8_t* inBuff = (uint8_t*)malloc(LZSS_BLOCK);
+  uint8_t* outBuff = (uint8_t*)malloc(LZSS_BLOCK);
+  uint8_t* sendBuff = (uint8_t*)malloc(SEND_BUFF_LEN);
+  esp_err_t res = ESP_OK;
+  if (inBuff == NULL || outBuff == NULL || sendBuff == NULL) {
+    LOG_ERR("Failed to allocate capture scan buffers");
+    res = ESP_FAIL;
+  } else {
+    if (asPcap) {
+      char pcapName[FILE_NAME_LEN] = "capture.pcapng";
+      if (strlen(fileName)) {
+        strncpy(pcapName, fileName, FILE_NAME_LEN - 8);
+        changeExtension(pcapName, "pcapng");
+      }
+      char contentDisp[FILE_NAME_LEN + 30];
+      snprintf(contentDisp, sizeof(contentDisp), "attachment; filename=%s", pcapName);
+      httpd_resp_set_type(req, "application/octet-stream");
+      httpd_resp_set_hdr(req, "Content-Disposition", contentDisp);
+      res = httpd_resp_send_chunk(req, (const char*)sendBuff, pcapHeader(sendBuff));
+    } else {
+      httpd_resp_set_type(req, "application/json");
+      res = httpd_resp_sendstr_chunk(req, "[");
+    }
+    uint32_t matched = 0;
+    char filePath[FILE_NAME_LEN];
+    if (strlen(fileName)) {
+      snprintf(filePath, FILE_NAME_LEN, "%s/%s", CAPTURE_DIR, fileName);
+      if (res == ESP_OK) res = scanFile(req, filePath, filter, asPcap, inBuff, outBuff, sendBuff, matched);
+    } else {
+      int lastSeq = captureSeq(false);
+      for (int seq = captureSeq(true); seq && seq <= lastSeq && res == ESP_OK; seq++) {
+        snprintf(filePath, FILE_NAME_LEN, "%s/cap%05d%s", CAPTURE_DIR, seq, LZS_EXT);
+        res = scanFile(req, filePath, filter, asPcap, inBuff, outBuff, sendBuff, matched);
+      }
+    }
+    if (!asPcap) httpd_resp_sendstr_chunk(req, "]");
+    LOG_INF("Capture %s output %lu records as %s", strlen(fileName) ? fileName : "files", matched, asPcap ? "pcapng" : "json");
+    httpd_resp_sendstr_chunk(req, NULL);
+  }
+  free(inBuff);
+  free(outBuff);
+  free(sendBuff);
+  return res;
+}
+
+esp_err_t capturePcapng(httpd_req_t* req, const char* fileName) {
+  // download given capture file, or all capture files filtered by time and DP if given, as pcapng
+  if (strchr(fileName, '/') != NULL) return ESP_FAIL;
+  captureFilter filter;
+  if (parseFilter(fileName, filter)) return scanCaptures(req, "", &filter, true);
+  return scanCaptures(req, fileName, NULL, true);
+}
+
+esp_err_t captureQuery(httpd_req_t* req, const char* filterStr) {
+  // return json of captured records within time range, optionally containing given DP
+  captureFilter filter;
+  if (!parseFilter(filterStr, filter)) return ESP_FAIL;
+  return scanCaptures(req, "", &filter, false);
+}
+
+/***************************** TCP tap ******************************/
+
+// Optional TCP server streaming each sniffed frame as a binary record, being the same
+// captureHdr + frame bytes as stored in capture files, so host tools can parse either.
+// Sends never block the uart tasks: each client has a pending buffer for partially sent
+// records, and a record that does not fit is dropped for that client and counted.
+
+#define TAP_CLIENTS 2
+#define TAP_PENDING 1024 // per client unsent record bytes
+#define TAP_POLL_MS 100
+
+int tapPort = 0; // 0 = disabled
+static int tapListen = -1;
+static SemaphoreHandle_t tapMutex = NULL;
+
+struct tapClient {
+  int sock;
+  uint32_t dropped; // records dropped due to backpressure
+  size_t pendLen;
+  byte pending[TAP_PENDING];
+};
+static tapClient tapClients[TAP_CLIENTS];
+
+static void tapClose(tapClient& tc) {
+  // tapMutex must be held
+  LOG_INF("TCP tap client disconnected, %lu records dropped", tc.dropped);
+  close(tc.sock);
+  tc.sock = -1;
+}
+
+static void tapSend(tapClient& tc) {
+  // send as much pending data as socket accepts without blocking, tapMutex must be held
+  while (tc.pendLen) {
+    int sent = send(tc.sock, tc.pending, tc.pendLen, MSG_DONTWAIT);
+    if (sent > 0) {
+      tc.pendLen -= sent;
+      memmove(tc.pending, tc.pending + sent, tc.pendLen);
+    } else {
+      if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) tapClose(tc);
+      break;
+    }
+  }
+}
+
+static void tapFrame(int uartNum, const byte* tuyaData, size_t tuyaDataLen) {
+  // queue frame record to each connected client
+  if (tapListen < 0) return;
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  captureHdr hdr = {(uint32_t)tv.tv_sec, (uint32_t)tv.tv_usec, (uint16_t)tuyaDataLen, (uint8_t)uartNum, 0};
+  size_t recLen = sizeof(hdr) + tuyaDataLen;
+  xSemaphoreTake(tapMutex, portMAX_DELAY);
+  for (auto& tc : tapClients) {
+    if (tc.sock < 0) continue;
+    if (tc.pendLen + recLen > TAP_PENDING) tapSend(tc); // make room
+    if (tc.sock < 0) continue;
+    if (tc.pendLen + recLen > TAP_PENDING) tc.dropped++;
+    else {
+      memcpy(tc.pending + tc.pendLen, &hdr, sizeof(hdr));
+      memcpy(tc.pending + tc.pendLen + sizeof(hdr), tuyaData, tuyaDataLen);
+      tc.pendLen += recLen;
+      tapSend(tc);
+    }
+  }
+  xSemaphoreGive(tapMutex);
+}
+
+static void tapTask(void* parameter) {
+  // accept clients, detect disconnects and send any pending data 
+  while (true) {
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(tapListen, &readSet);
+    int maxSock = tapListen;
+    xSemaphoreTake(tapMutex, portMAX_DELAY);
+    for (auto& tc : tapClients) {
+      if (tc.sock < 0) continue;
+      FD_SET(tc.sock, &readSet);
+      maxSock = max(maxSock, tc.sock);
+    }
+    xSemaphoreGive(tapMutex);
+    struct timeval tout = {0, TAP_POLL_MS * 1000};
+    int ready = select(maxSock + 1, &readSet, NULL, NULL, &tout);
+    xSemaphoreTake(tapMutex, portMAX_DELAY);
+    for (auto& tc : tapClients) {
+      if (tc.sock < 0) continue;
+      if (ready > 0 && FD_ISSET(tc.sock, &readSet)) {
+        // client input is ignored, zero length read means closed
+        byte discard[64];
+        int got = recv(tc.sock, discard, sizeof(discard), MSG_DONTWAIT);
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+          tapClose(tc);
+          continue;
+        }
+      }
+      tapSend(tc);
+    }
+    if (ready > 0 && FD_ISSET(tapListen, &readSet)) {
+      int sock = accept(tapListen, NULL, NULL);
+      if (sock >= 0) {
+        tapClient* tc = NULL;
+        for (auto& c : tapClients) if (c.sock < 0) tc = &c;
+        if (tc == NULL) {
+          LOG_WRN("TCP tap rejected client, max %d connected", TAP_CLIENTS);
+          close(sock);
+        } else {
+          fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+          int noDelay = 1;
+          setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+          tc->sock = sock;
+          tc->pendLen = 0;
+          tc->dropped = 0;
+          LOG_INF("TCP tap client connected");
+        }
+      }
+    }
+    xSemaphoreGive(tapMutex);
+  }
+}
+
+static void startTap() {
+  // start TCP tap server if port configured
+  if (!tapPort) return;
+  for (auto& tc : tapClients) tc.sock = -1;
+  tapListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (tapListen >= 0) {
+    int reuse = 1;
+    setsockopt(tapListen, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(tapPort);
+    if (bind(tapListen, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(tapListen, 1) == 0) {
+      tapMutex = xSemaphoreCreateMutex();
+      xTaskCreate(tapTask, "tapTask", 1024 * 3, NULL, 1, NULL);
+      LOG_INF("TCP tap listening on port %d", tapPort);
+      return;
+    }
+    close(tapListen);
+    tapListen = -1;
+  }
+  LOG_ERR("Failed to start TCP tap on port %d, error %d", tapPort, errno);
+}
+
+/**************************** DP catalogue ****************************/
+
+// Properties of each DP seen while sniffing are accumulated to help identify DPs:
+// type, length and value range, distinct values, report rate, and direction used.
+// Exported as json, or as a skeleton of the processDP() switch for this app.
+
+#define CAT_DPS 48 // max DPs catalogued
+#define CAT_DISTINCT 8 // max distinct values retained per DP
+
+struct dpCatStruct {
+  uint8_t dpId;
+  uint8_t dpType;
+  uint8_t dirs; // bit 0 set by wifi, bit 1 reported by MCU
+  uint8_t distinctCnt; // CAT_DISTINCT + 1 if more values seen
+  uint16_t minLen;
+  uint16_t maxLen;
+  int32_t minVal; // numeric types only
+  int32_t maxVal;
+  int32_t distinct[CAT_DISTINCT];
+  uint32_t sets; // writes from wifi
+  uint32_t reports; // reports from MCU
+  uint32_t firstReport; // millis
+  uint32_t lastReport;
+};
+static dpCatStruct dpCat[CAT_DPS];
+static int dpCatCnt = 0;
+
+static int32_t dpValue(const byte* unit, uint16_t unitLen) {
+  // big endian DP value, up to 4 bytes
+  uint32_t value = 0;
+  for (int i = 0; i < min(unitLen, (uint16_t)4); i++) value = (value << 8) | unit[i];
+  return (int32_t)value;
+}
+
+static void catalogueDP(int uartNum, uint8_t dpId, uint8_t dpType, const byte* dpVal, uint16_t dpLen) {
+  // add DP unit to catalogue, readMutex held
+  int i = 0;
+  while (i < dpCatCnt && dpCat[i].dpId != dpId) i++;
+  if (i >= CAT_DPS) return;
+  dpCatStruct& dc = dpCat[i];
+  if (i == dpCatCnt) {
+    dpCatCnt++;
+    memset(&dc, 0, sizeof(dc));
+    dc.dpId = dpId;
+    dc.minLen = dpLen;
+    dc.minVal = INT32_MAX;
+    dc.maxVal = INT32_MIN;
+  }
+  dc.dpType = dpType;
+  dc.minLen = min(dc.minLen, dpLen);
+  dc.maxLen = max(dc.maxLen, dpLen);
+  if (uartNum) {
+    uint32_t nowMs = millis();
+    if (!dc.reports++) dc.firstReport = nowMs;
+    dc.lastReport = nowMs;
+  } else dc.sets++;
+  dc.dirs |= uartNum ? 0x02 : 0x01;
+  if ((dpType == 1 || dpType == 2 || dpType == 4 || dpType == 5) && dpLen && dpLen <= 4) {
+    // numeric value
+    int32_t value = dpValue(dpVal, dpLen);
+    dc.minVal = min(dc.minVal, value);
+    dc.maxVal = max(dc.maxVal, value);
+    int d = 0;
+    while (d < min((int)dc.distinctCnt, CAT_DISTINCT) && dc.distinct[d] != value) d++;
+    if (d == dc.distinctCnt) {
+      if (d < CAT_DISTINCT) dc.distinct[d] = value;
+      dc.distinctCnt++;
+    }
+  }
+}
+
+static void catalogueDesc(const dpCatStruct& dc, char* desc, size_t descLen) {
+  // summarise catalogue entry as text
+  int pos = snprintf(desc, descLen, "%s, %u", dc.dpType <= 5 ? dpTypeStr[dc.dpType] : "?", dc.minLen);
+  if (dc.maxLen != dc.minLen) pos += snprintf(desc + pos, descLen - pos, "-%u", dc.maxLen);
+  pos += snprintf(desc + pos, descLen - pos, " bytes");
+  if (dc.minVal <= dc.maxVal) {
+    if (dc.distinctCnt > CAT_DISTINCT) pos += snprintf(desc + pos, descLen - pos, ", range %ld to %ld", dc.minVal, dc.maxVal);
+    else {
+      pos += snprintf(desc + pos, descLen - pos, ", values");
+      for (int d = 0; d < dc.distinctCnt; d++) pos += snprintf(desc + pos, descLen - pos, "%s%ld", d ? "," : " ", dc.distinct[d]);
+    }
+  }
+  if (dc.reports > 1) pos += snprintf(desc + pos, descLen - pos, ", reported every %lu secs", 
+    (dc.lastReport - dc.firstReport) / (dc.reports - 1) / 1000);
+  if (dc.dirs & 0x01) snprintf(desc + pos, descLen - pos, ", set by wifi");
+}
+
+esp_err_t dpCatalogue(httpd_req_t* req, const char* format) {
+  // return catalogue as json, or as processDP() switch cases if format is code
+  dpCatStruct* catCopy = (dpCatStruct*)malloc(sizeof(dpCat));
+  if (catCopy == NULL) return ESP_FAIL;
+  xSemaphoreTake(readMutex, portMAX_DELAY);
+  int catCnt = min(dpCatCnt, CAT_DPS);
+  memcpy(catCopy, dpCat, catCnt * sizeof(dpCatStruct));
+  xSemaphoreGive(readMutex);
+  bool asCode = !strcmp(format, "code");
+  char desc[200];
+  char item[sizeof(desc) + 200];
+  httpd_resp_set_type(req, asCode ? "text/plain" : "application/json");
+  if (!asCode) httpd_resp_sendstr_chunk(req, "{");
+  for (int i = 0; i < catCnt; i++) {
+    dpCatStruct& dc = catCopy[i];
+    catalogueDesc(dc, desc, sizeof(desc));
+    if (asCode) {
+      int pos = snprintf(item, sizeof(item), "    case %u: // %s\n", dc.dpId, desc);
+      if (dc.dpType == 2) pos += snprintf(item + pos, sizeof(item) - pos, "      sprintf(formatted, \"%%ld\", mcuTuya.tuyaInt);\n");
+      else if (dc.dpType == 1 || dc.dpType == 4) pos += snprintf(item + pos, sizeof(item) - pos, "      sprintf(formatted, \"%%u\", mcuTuya.tuyaData[0]);\n");
+      else if (dc.dpType == 3) pos += snprintf(item + pos, sizeof(item) - pos, "      sprintf(formatted, \"%%.*s\", mcuTuya.tuyaLen, mcuTuya.tuyaData);\n");
+      else pos += snprintf(item + pos, sizeof(item) - pos, "      // data in mcuTuya.tuyaData, length mcuTuya.tuyaLen\n");
+      if (dc.dpType >= 1 && dc.dpType <= 4) pos += snprintf(item + pos, sizeof(item) - pos, "      wsJsonSend(\"dp%u\", formatted);\n", dc.dpId);
+      snprintf(item + pos, sizeof(item) - pos, "    break;\n");
+    } else {
+      int pos = snprintf(item, sizeof(item), "%s\"%u\":{\"type\":\"%s\",\"minLen\":%u,\"maxLen\":%u", i ? "," : "", 
+        dc.dpId, dc.dpType <= 5 ? dpTypeStr[dc.dpType] : "?", dc.minLen, dc.maxLen);
+      if (dc.minVal <= dc.maxVal) {
+        pos += snprintf(item + pos, sizeof(item) - pos, ",\"min\":%ld,\"max\":%ld,\"values\":[", dc.minVal, dc.maxVal);
+        for (int d = 0; d < min((int)dc.distinctCnt, CAT_DISTINCT); d++) 
+          pos += snprintf(item + pos, sizeof(item) - pos, "%s%ld", d ? "," : "", dc.distinct[d]);
+        pos += snprintf(item + pos, sizeof(item) - pos, "],\"moreValues\":%s", dc.distinctCnt > CAT_DISTINCT ? "true" : "false");
+      }
+      snprintf(item + pos, sizeof(item) - pos, ",\"sets\":%lu,\"reports\":%lu,\"reportSecs\":%lu}", dc.sets, dc.reports, 
+        dc.reports > 1 ? (dc.lastReport - dc.firstReport) / (dc.reports - 1) / 1000 : 0);
+    }
+    httpd_resp_sendstr_chunk(req, item);
+  }
+  if (!asCode) httpd_resp_sendstr_chunk(req, "}");
+  httpd_resp_sendstr_chunk(req, NULL);
+  free(catCopy);
+  return ESP_OK;
+}
+
+/************************** sniffer DP state **************************/
+
+// Latest value of each DP seen in each direction, so that in diff mode only DP value 
+// transitions are output, and a snapshot of all DP values can be obtained.
+
+#define SNIFF_DPS 32 // max DPs tracked per direction
+#define SNIFF_VAL_LEN 32 // max DP value bytes retained
+
+bool diffMode = false;
+
+struct dpStateStruct {
+  uint8_t dpId;
+  uint8_t dpType;
+  uint16_t dpLen;
+  uint8_t dpVal[SNIFF_VAL_LEN];
+  uint32_t updates; // number of reports of this DP
+};
+static dpStateStruct dpState[2][SNIFF_DPS];
+static int dpStateCnt[2] = {0, 0};
+
+static void formatDPvalue(char* valStr, size_t valLen, uint8_t dpType, const byte* dpVal, uint16_t dpLen) {
+  // format DP value according to its data type
+  valStr[0] = 0;
+  dpLen = min(dpLen, (uint16_t)SNIFF_VAL_LEN);
+  if (dpType == 1 && dpLen) snprintf(valStr, valLen, "%s", dpVal[0] ? "ON" : "OFF");
+  else if (dpType == 2 && dpLen >= 4) snprintf(valStr, valLen, "%ld", (int32_t)((dpVal[0] << 24) | (dpVal[1] << 16) | (dpVal[2] << 8) | dpVal[3]));
+  else if (dpType == 3) {
+    snprintf(valStr, valLen, "%.*s", (int)dpLen, (const char*)dpVal);
+    replaceChar(valStr, '"', '\'');
+  }
+  else if (dpType == 4 && dpLen) snprintf(valStr, valLen, "%u", dpVal[0]);
+  else {
+    // raw and bitmap as stream of numbers
+    for (int i = 0; i < dpLen && strlen(valStr) < valLen - 5; i++) sprintf(valStr + strlen(valStr), "%u ", dpVal[i]);
+  }
+}
+
+static void updateDPstate(int uartNum, const byte* tuyaData, size_t tuyaDataLen) {
+  // update state table for this direction from each DP unit in frame, output changes if diff mode
+  if (tuyaDataLen < 11 || (tuyaData[3] != 6 && tuyaData[3] != 7)) return;
+  size_t dataEnd = tuyaDataLen - 1; // exclude checksum
+  size_t dpPos = 6;
+  while (dpPos + 4 <= dataEnd) {
+    // each DP unit is id, type, 2 byte length, value
+    uint8_t dpId = tuyaData[dpPos];
+    uint8_t dpType = tuyaData[dpPos + 1];
+    uint16_t dpLen = (tuyaData[dpPos + 2] << 8) | tuyaData[dpPos + 3];
+    const byte* dpVal = tuyaData + dpPos + 4;
+    if (dpPos + 4 + dpLen > dataEnd) break; // truncated
+    dpPos += 4 + dpLen;
+    catalogueDP(uartNum, dpId, dpType, dpVal, dpLen);
+    int i = 0;
+    while (i < dpStateCnt[uartNum] && dpState[uartNum][i].dpId != dpId) i++;
+    if (i == SNIFF_DPS) {
+      LOG_VRB("DP state table full, DP %u ignored", dpId);
+      continue;
+    }
+    dpStateStruct& dp = dpState[uartNum][i];
+    bool isNew = i == dpStateCnt[uartNum];
+    uint16_t valLen = min(dpLen, (uint16_t)SNIFF_VAL_LEN);
+    bool changed = isNew || dp.dpType != dpType || dp.dpLen != dpLen || memcmp(dp.dpVal, dpVal, valLen);
+    if (changed && diffMode) {
+      char oldStr[SNIFF_VAL_LEN * 4] = "-";
+      char newStr[SNIFF_VAL_LEN * 4];
+      if (!isNew) formatDPvalue(oldStr, sizeof(oldStr), dp.dpType, dp.dpVal, dp.dpLen);
+      formatDPvalue(newStr, sizeof(newStr), dpType, dpVal, dpLen);
+      LOG_INF("%s > DP %u: %s → %s", uart[uartNum].destName, dpId, oldStr, newStr);
+    }
+    if (isNew) {
+      dpStateCnt[uartNum]++;
+      dp.dpId = dpId;
+      dp.updates = 0;
+    }
+    dp.dpType = dpType;
+    dp.dpLen = dpLen;
+    memcpy(dp.dpVal, dpVal, valLen);
+    dp.updates++;
+  }
+}
+
+esp_err_t snifferSnapshot(httpd_req_t* req) {
+  // return json of current value of every DP seen in each direction
+  // copy tables so uart processing not held up by web response
+  dpStateStruct* stateCopy = (dpStateStruct*)malloc(sizeof(dpState));
+  if (stateCopy == NULL) return ESP_FAIL;
+  int stateCnt[2];
+  xSemaphoreTake(readMutex, portMAX_DELAY);
+  memcpy(stateCopy, dpState, sizeof(dpState));
+  memcpy(stateCnt, dpStateCnt, sizeof(dpStateCnt));
+  xSemaphoreGive(readMutex);
+
+  char valStr[SNIFF_VAL_LEN * 4];
+  char jsonItem[sizeof(valStr) + 80];
+  httpd_resp_set_type(req, "application/json");
+  for (int dir = 0; dir < 2; dir++) {
+    sprintf(jsonItem, "%s\"%s\":{", dir ? "," : "{", uart[dir].destName);
+    httpd_resp_sendstr_chunk(req, jsonItem);
+    for (int i = 0; i < stateCnt[dir]; i++) {
+      dpStateStruct& dp = stateCopy[dir * SNIFF_DPS + i];
+      formatDPvalue(valStr, sizeof(valStr), dp.dpType, dp.dpVal, dp.dpLen);
+      snprintf(jsonItem, sizeof(jsonItem), "%s\"%u\":{\"type\":\"%s\",\"value\":\"%s\",\"updates\":%lu}", 
+        i ? "," : "", dp.dpId, dp.dpType <= 5 ? dpTypeStr[dp.dpType] : "?", valStr, dp.updates);
+      httpd_resp_sendstr_chunk(req, jsonItem);
+    }
+    httpd_resp_sendstr_chunk(req, "}");
+  }
+  httpd_resp_sendstr_chunk(req, "}");
+  httpd_resp_sendstr_chunk(req, NULL);
+  free(stateCopy);
+  return ESP_OK;
+}
+
+static void snifferFrame(int uartNum, const byte* tuyaData, size_t tuyaDataLen, int64_t gapUs) {
+  // output complete frame received in sniffer mode
+  captureFrame(uartNum, tuyaData, tuyaDataLen);
+  tapFrame(uartNum, tuyaData, tuyaDataLen);
+  updateDPstate(uartNum, tuyaData, tuyaDataLen);
+  if (diffMode) return; // only DP changes are output
+  if (!foldFrame(uartNum, tuyaData, tuyaDataLen)) formatTuya(uartNum, tuyaData, tuyaDataLen, false, gapUs);
+}
+
+/************************* latency histograms *************************/
+
+// Response latencies counted in log2 millisecond buckets, so fixed small size, 
+// with percentiles estimated by interpolating within the relevant bucket
+
+void latencyAdd(latencyStruct& lat, uint32_t ms) {
+  // bucket 0 is 0 ms, bucket n is 2^(n-1) to 2^n - 1 ms
+  int bucket = ms ? 32 - __builtin_clz(ms) : 0;
+  lat.bucket[min(bucket, LAT_BUCKETS - 1)]++;
+  lat.count++;
+  if (ms > lat.maxMs) lat.maxMs = ms;
+}
+
+uint32_t latencyPercentile(const latencyStruct& lat, int pcnt) {
+  // estimate latency in ms at given percentile
+  if (!lat.count) return 0;
+  uint32_t rank = (lat.count * pcnt + 99) / 100;
+  uint32_t counted = 0;
+  for (int i = 0; i < LAT_BUCKETS; i++) {
+    if (lat.bucket[i] && counted + lat.bucket[i] >= rank) {
+      uint32_t lower = i ? 1 << (i - 1) : 0;
+      uint32_t upper = i ? 1 << i : 1;
+      uint32_t estimate = lower + (upper - lower) * (rank - counted) / lat.bucket[i];
+      return min(estimate, lat.maxMs);
+    }
+    counted += lat.bucket[i];
+  }
+  return lat.maxMs;
+}
+
+void latencySummary(const latencyStruct& lat, char* outStr, size_t outLen) {
+  snprintf(outStr, outLen, "n %lu, p50 %lu, p90 %lu, p99 %lu, max %lu ms, timeouts %lu, dropped %lu", lat.count, 
+    latencyPercentile(lat, 50), latencyPercentile(lat, 90), latencyPercentile(lat, 99), lat.maxMs, lat.timeouts, lat.dropped);
+}
+
+void latencyJson(char* jsonStr, size_t jsonLen, const latencyStruct& lat) {
+  snprintf(jsonStr, jsonLen, "{\"count\":%lu,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"max\":%lu,\"timeouts\":%lu,\"dropped\":%lu}", 
+    lat.count, latencyPercentile(lat, 50), latencyPercentile(lat, 90), latencyPercentile(lat, 99), lat.maxMs, lat.timeouts, lat.dropped);
+}
+
+/*********************** command script runner ***********************/
+
+// Runs a script of tuya commands from storage to load test the MCU. Each line is:
+//   interval_ms repeat_count command
+// where command is as entered on the web monitor, eg: 200 50 M 6 2 2 190
+// Lines starting with # are comments. Each command is sent at its interval paced by 
+// esp_timer, and the latency to the matching MCU response is recorded per script line.
+
+#define SCRIPT_LINES 16
+#define SCRIPT_CMD_LEN 64
+#define SCRIPT_PENDING 8 // max commands awaiting response
+#define SCRIPT_TIMEOUT 1000 // ms to wait for response
+
+struct scriptLineStruct {
+  uint32_t interval; // ms between sends
+  uint32_t repeats;
+  char cmd[SCRIPT_CMD_LEN];
+  uint32_t sent;
+  latencyStruct latency;
+};
+
+struct pendingStruct {
+  int line;
+  uint8_t expectCmd; // command number of response
+  int16_t expectDP; // DP id of response, -1 for any
+  int64_t sentUs; // time queued, then time transmitted
+  uint32_t seq; // identifies command in transmit done callback
+};
+
+static scriptLineStruct* scriptLines = NULL;
+static int scriptLineCnt = 0;
+static pendingStruct pending[SCRIPT_PENDING];
+static int pendingCnt = 0;
+static portMUX_TYPE scriptMux = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t scriptTimer = NULL;
+static TaskHandle_t scriptHandle = NULL;
+static volatile bool scriptStop = false;
+static uint32_t pendingSeq = 0;
+
+static uint8_t responseCmd(uint8_t cmd) {
+  // command number of MCU response, DP write or query gets DP report, others echoed
+  return (cmd == 6 || cmd == 8) ? 7 : cmd;
+}
+
+static void expirePending(bool all) {
+  // count pending commands without response in time as timeouts
+  int64_t expiry = esp_timer_get_time() - SCRIPT_TIMEOUT * 1000;
+  portENTER_CRITICAL(&scriptMux);
+  while (pendingCnt && (all || pending[0].sentUs < expiry)) {
+    scriptLines[pending[0].line].latency.timeouts++;
+    memmove(pending, pending + 1, --pendingCnt * sizeof(pendingStruct));
+  }
+  portEXIT_CRITICAL(&scriptMux);
+}
+
+static void dropPending() {
+  // evict oldest pending command to make room, scriptMux held
+  scriptLines[pending[0].line].latency.dropped++;
+  memmove(pending, pending + 1, --pendingCnt * sizeof(pendingStruct));
+}
+
+static uint32_t addPending(int line) {
+  // record command sent to MCU and response expected, returns sequence number or 0 if none
+  int cmdNum = -1, dpId = -1;
+  sscanf(scriptLines[line].cmd + 1, "%d %d", &cmdNum, &dpId);
+  if (scriptLines[line].cmd[0] != uart[0].uartId || cmdNum < 0) return 0; // not to MCU 
+  portENTER_CRITICAL(&scriptMux);
+  if (pendingCnt == SCRIPT_PENDING) dropPending();
+  pendingStruct& pend = pending[pendingCnt++];
+  pend.line = line;
+  pend.expectCmd = responseCmd(cmdNum);
+  pend.expectDP = cmdNum == 6 ? dpId : -1;
+  pend.sentUs = esp_timer_get_time();
+  if (!++pendingSeq) pendingSeq++; // skip 0
+  pend.seq = pendingSeq;
+  portEXIT_CRITICAL(&scriptMux);
+  return pend.seq;
+}
+
+static void scriptTxDone(int uartNum, const byte* txData, size_t txLen, bool sent, int64_t queuedUs, int64_t doneUs, void* txArg) {
+  // time response from when command transmitted, if still pending
+  uint32_t seq = (uint32_t)(uintptr_t)txArg;
+  portENTER_CRITICAL(&scriptMux);
+  for (int i = 0; i < pendingCnt; i++) {
+    if (pending[i].seq == seq) {
+      pending[i].sentUs = doneUs;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&scriptMux);
+}
+
+static void scriptResponse(const byte* tuyaData, size_t tuyaDataLen) {
+  // match frame from MCU to oldest pending command expecting it
+  if (!pendingCnt) return;
+  int64_t nowUs = esp_timer_get_time();
+  portENTER_CRITICAL(&scriptMux);
+  for (int i = 0; i < pendingCnt; i++) {
+    if (pending[i].expectCmd == tuyaData[3] && (pending[i].expectDP < 0 || (tuyaDataLen > 6 && pending[i].expectDP == tuyaData[6]))) {
+      latencyAdd(scriptLines[pending[i].line].latency, (nowUs - pending[i].sentUs) / 1000);
+      memmove(pending + i, pending + i + 1, (--pendingCnt - i) * sizeof(pendingStruct));
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&scriptMux);
+}
+
+static void scriptTimerCB(void* arg) {
+  if (scriptHandle != NULL) xTaskNotifyGive(scriptHandle);
+}
+
+static void scriptTask(void* arg) {
+  // send each script line for its repeat count, paced by timer
+  for (int line = 0; line < scriptLineCnt && !scriptStop; line++) {
+    scriptLineStruct& sl = scriptLines[line];
+    ulTaskNotifyTake(pdTRUE, 0); // clear any stale tick
+    esp_timer_start_periodic(scriptTimer, sl.interval * 1000);
+    for (uint32_t i = 0; i < sl.repeats && !scriptStop; i++) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY); 
+      expirePending(false);
+      uint32_t seq = addPending(line);
+      processTuyaMsg(sl.cmd, seq ? scriptTxDone : NULL, (void*)(uintptr_t)seq);
+      sl.sent++;
+    }
+    esp_timer_stop(scriptTimer);
+  }
+  delay(SCRIPT_TIMEOUT); // allow for final responses
+  expirePending(true);
+  // summarise results
+  char summary[100];
+  for (int line = 0; line < scriptLineCnt; line++) {
+    latencySummary(scriptLines[line].latency, summary, sizeof(summary));
+    LOG_INF("Script line %d [%s] sent %lu: %s", line + 1, scriptLines[line].cmd, scriptLines[line].sent, summary);
+  }
+  LOG_INF("Script %s", scriptStop ? "stopped" : "completed");
+  scriptHandle = NULL;
+  vTaskDelete(NULL);
+}
+
+static bool loadScript(const char* fileName) {
+  // load script lines from file in data folder
+  char scriptPath[FILE_NAME_LEN];
+  snprintf(scriptPath, FILE_NAME_LEN, "%s/%s", DATA_DIR, fileName);
+  File file = STORAGE.open(scriptPath, FILE_READ);
+  if (!file) {
+    LOG_WRN("Script file %s not found", scriptPath);
+    return false;
+  }
+  if (scriptLines == NULL) scriptLines = (scriptLineStruct*)malloc(SCRIPT_LINES * sizeof(scriptLineStruct));
+  if (scriptLines == NULL) {
+    LOG_ERR("Failed to allocate script lines");
+    file.close();
+    return false;
+  }
+  memset(scriptLines, 0, SCRIPT_LINES * sizeof(scriptLineStruct));
+  scriptLineCnt = 0;
+  while (file.available() && scriptLineCnt < SCRIPT_LINES) {
+    String lineStr = file.readStringUntil('\n');
+    lineStr.trim();
+    if (!lineStr.length() || lineStr[0] == '#') continue;
+    scriptLineStruct& sl = scriptLines[scriptLineCnt];
+    int cmdPos = 0;
+    if (sscanf(lineStr.c_str(), "%lu %lu %n", &sl.interval, &sl.repeats, &cmdPos) < 2 || !cmdPos || !sl.interval) {
+      LOG_WRN("Invalid script line: %s", lineStr.c_str());
+      continue;
+    }
+    strncpy(sl.cmd, lineStr.c_str() + cmdPos, SCRIPT_CMD_LEN - 1);
+    scriptLineCnt++;
+  }
+  file.close();
+  LOG_INF("Loaded %d lines from script %s", scriptLineCnt, scriptPath);
+  return scriptLineCnt > 0;
+}
+
+void runScript(const char* fileName) {
+  // start given script, or stop running script if no file name
+  if (scriptHandle != NULL) {
+    scriptStop = true;
+    if (strlen(fileName)) LOG_WRN("Script already running, stopping it");
+    return;
+  }
+  if (!strlen(fileName) || !uartReady || !loadScript(fileName)) return;
+  if (scriptTimer == NULL) {
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = &scriptTimerCB;
+    timerArgs.name = "scriptTimer";
+    esp_timer_create(&timerArgs, &scriptTimer);
+  }
+  pendingCnt = 0;
+  scriptStop = false;
+  xTaskCreate(scriptTask, "scriptTask", 1024 * 4, NULL, 2, &scriptHandle);
+}
+
+/********************* request / response pairing *********************/
+
+// Each sniffed command sent to the MCU is paired with the MCU response expected by the
+// protocol, so the MCU response time, from end of command to start of response, can be
+// measured per command, and commands not answered within PAIR_TIMEOUT flagged.
+
+#define PAIR_PENDING 8 // max commands awaiting response
+#define PAIR_CMDS 16 // max distinct commands tracked
+#define PAIR_TIMEOUT 1000 // ms to wait for response
+#define PAIR_REQUESTS 0x14F // bitmap of wifi module commands answered by MCU: 0, 1, 2, 3, 6, 8
+
+struct pairPendingStruct {
+  uint8_t cmd;
+  uint8_t expectCmd;
+  int16_t expectDP; // -1 for any
+  int64_t endUs; // time command completed
+};
+
+struct pairStatsStruct {
+  uint8_t cmd;
+  latencyStruct latency;
+};
+
+static pairPendingStruct pairPending[PAIR_PENDING];
+static int pairPendingCnt = 0;
+static pairStatsStruct pairStats[PAIR_CMDS];
+static int pairStatsCnt = 0;
+
+static latencyStruct* pairLatency(uint8_t cmd) {
+  // get stats for command, adding if new
+  for (int i = 0; i < pairStatsCnt; i++) if (pairStats[i].cmd == cmd) return &pairStats[i].latency;
+  if (pairStatsCnt == PAIR_CMDS) return NULL;
+  pairStats[pairStatsCnt].cmd = cmd;
+  return &pairStats[pairStatsCnt++].latency;
+}
+
+static void expirePairs(int64_t nowUs) {
+  // flag commands not answered in time, readMutex held
+  while (pairPendingCnt && nowUs - pairPending[0].endUs > PAIR_TIMEOUT * 1000) {
+    LOG_WRN("MCU did not answer cmd %u within %d ms", pairPending[0].cmd, PAIR_TIMEOUT);
+    latencyStruct* lat = pairLatency(pairPending[0].cmd);
+    if (lat != NULL) lat->timeouts++;
+    memmove(pairPending, pairPending + 1, --pairPendingCnt * sizeof(pairPendingStruct));
+  }
+}
+
+static void pairFrame(int uartNum, const byte* tuyaData, size_t tuyaDataLen, int64_t startUs, int64_t endUs) {
+  // record command to MCU, or match response from MCU to oldest command expecting it, readMutex held
+  uint8_t cmd = tuyaData[3];
+  int16_t dpId = tuyaDataLen > 7 ? tuyaData[6] : -1;
+  expirePairs(startUs);
+  if (uartNum == 0) {
+    // only requests originated by wifi module expect a response, others are its replies to MCU
+    if (cmd > 8 || !((1 << cmd) & PAIR_REQUESTS)) return;
+    if (pairPendingCnt == PAIR_PENDING) {
+      // evict oldest command to make room
+      latencyStruct* lat = pairLatency(pairPending[0].cmd);
+      if (lat != NULL) lat->dropped++;
+      memmove(pairPending, pairPending + 1, --pairPendingCnt * sizeof(pairPendingStruct));
+    }
+    pairPendingStruct& pp = pairPending[pairPendingCnt++];
+    pp.cmd = cmd;
+    pp.expectCmd = responseCmd(cmd);
+    pp.expectDP = cmd == 6 ? dpId : -1;
+    pp.endUs = endUs;
+    return;
+  }
+  for (int i = 0; i < pairPendingCnt; i++) {
+    if (pairPending[i].expectCmd == cmd && (pairPending[i].expectDP < 0 || pairPending[i].expectDP == dpId)) {
+      latencyStruct* lat = pairLatency(pairPending[i].cmd);
+      if (lat != NULL) latencyAdd(*lat, max(startUs - pairPending[i].endUs, (int64_t)0) / 1000);
+      memmove(pairPending + i, pairPending + i + 1, (--pairPendingCnt - i) * sizeof(pairPendingStruct));
+      break;
+    }
+  }
+}
+
+esp_err_t pairingJson(httpd_req_t* req) {
+  // return json of MCU response time per command
+  pairStatsStruct* statsCopy = (pairStatsStruct*)malloc(sizeof(pairStats));
+  if (statsCopy == NULL) return ESP_FAIL;
+  xSemaphoreTake(readMutex, portMAX_DELAY);
+  int statsCnt = pairStatsCnt;
+  memcpy(statsCopy, pairStats, statsCnt * sizeof(pairStatsStruct));
+  xSemaphoreGive(readMutex);
+  char jsonItem[150];
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr_chunk(req, "{");
+  for (int i = 0; i < statsCnt; i++) {
+    int keyLen = snprintf(jsonItem, sizeof(jsonItem), "%s\"%u\":", i ? "," : "", statsCopy[i].cmd);
+    latencyJson(jsonItem + keyLen, sizeof(jsonItem) - keyLen, statsCopy[i].latency);
+    httpd_resp_sendstr_chunk(req, jsonItem);
+  }
+  httpd_resp_sendstr_chunk(req, "}");
+  httpd_resp_sendstr_chunk(req, NULL);
+  free(statsCopy);
+  return ESP_OK;
+}
+
+static size_t resyncParser(int p) {
+  // discard any partial frame of given parser and search for next header, returns bytes discarded
+  size_t discarded = tuyaIdx[p];
+  haveHdr[p] = false;
+  tuyaIdx[p] = 0;
+  msgLen[p] = BUFF_LEN - 10;
+  passBytes[p] = 0;
+  return discarded;
+}
+
+/************************** wire order merge **************************/
+
+// Each direction is read by a separate task, so frames can complete out of wire order.
+// Each frame is timestamped at its first byte, estimated from the uart event time, and
+// held in a small reorder buffer until no earlier frame can still arrive from the other
+// direction. Frames are then output in start time order with the gap from the previous frame.
+// A frame that starts earlier can be delivered later when the other direction is still
+// receiving a longer frame, so frames are held for REORDER_MS, enough for typical frames.
+
+#define REORDER_FRAMES 8
+#define REORDER_MS 100 // min time a frame is held for an earlier frame from other direction
+#define CHAR_US (10 * USECS / TUYA_BAUD_RATE) // time to receive one char
+
+struct reorderStruct {
+  int uartNum;
+  int64_t startUs; // time of first byte
+  int64_t heldUs; // time frame was completed
+  size_t frameLen;
+  byte frame[BUFF_LEN];
+};
+static reorderStruct reorder[REORDER_FRAMES];
+static int reorderCnt = 0;
+static int64_t lastOutUs = 0; // start time of previous frame output
+
+static void stampBuffered(uart_port_t uartNum) {
+  // estimate arrival time of first byte in rx buffer when uart event received,
+  // if less than threshold then event was raised by idle timeout after last byte
+  int64_t eventUs = esp_timer_get_time();
+  size_t buffered = 0;
+  uart_get_buffered_data_len((uart_port_t)(uartNum + uOffset), &buffered);
+  int64_t lastByteUs = eventUs - (buffered < rxThreshUsed[uartNum] ? rxToutUsed[uartNum] * CHAR_US : 0);
+  nextByteUs[uartNum] = lastByteUs - (int64_t)(buffered ? buffered - 1 : 0) * CHAR_US;
+}
+
+static void releaseFrames(bool all) {
+  // output held frames in start time order once no earlier frame can arrive, readMutex held
+  int64_t nowUs = esp_timer_get_time();
+  expirePairs(nowUs - REORDER_MS * 2000); // allow for responses still held
+  while (reorderCnt) {
+    int first = 0;
+    for (int i = 1; i < reorderCnt; i++) if (reorder[i].startUs < reorder[first].startUs) first = i;
+    reorderStruct& rf = reorder[first];
+    if (!all) {
+      if (nowUs - rf.heldUs < REORDER_MS * 1000) break;
+      int other = rf.uartNum ^ 0x01;
+      if (haveHdr[other] && frameStartUs[other] < rf.startUs) break; // earlier frame still being received
+    }
+    snifferFrame(rf.uartNum, rf.frame, rf.frameLen, lastOutUs ? rf.startUs - lastOutUs : -1);
+    pairFrame(rf.uartNum, rf.frame, rf.frameLen, rf.startUs, rf.startUs + rf.frameLen * CHAR_US);
+    lastOutUs = rf.startUs;
+    if (first != --reorderCnt) reorder[first] = reorder[reorderCnt];
+  }
+}
+
+static void holdFrame(int uartNum, const byte* tuyaData, size_t tuyaDataLen) {
+  // add completed frame to reorder buffer
+  if (reorderCnt == REORDER_FRAMES) releaseFrames(true);
+  reorderStruct& rf = reorder[reorderCnt++];
+  rf.uartNum = uartNum;
+  rf.startUs = frameStartUs[uartNum];
+  rf.heldUs = esp_timer_get_time();
+  rf.frameLen = tuyaDataLen;
+  memcpy(rf.frame, tuyaData, tuyaDataLen);
+}
+
+/*************************** virtual uart ****************************/
+
+// Either side can be replaced by a TCP client, eg a host based MCU or wifi module 
+// simulator, which sends and receives the raw tuya byte stream, so that forwarding and 
+// decoding continue as for a physical uart. Data for the virtual side when no client 
+// is connected is discarded.
+
+#define VUART_SEND_MS 100 // max time a send to client can block
+
+int vuartSide = 0; // 0 = none, 1 = MCU, 2 = Wifi
+int vuartPort = 7000;
+static int vuartNum = -1; // uart replaced by virtual uart
+static int vuartListen = -1;
+static int vuartSock = -1; // connected client
+static SemaphoreHandle_t vuartMutex = NULL;
+
+struct simFrameStruct {
+  // frame written to simulated MCU
+  int64_t sentUs;
+  size_t len;
+  byte data[BUFF_LEN];
+};
+static QueueHandle_t simQueue = NULL; // captures writes to MCU when MCU simulated
+static uint32_t simIgnored = 0; // frames from real MCU ignored while simulated
+
+static int uartSend(int uartNum, const byte* txData, size_t txLen) {
+  // send data to physical or virtual uart, returns bytes sent
+  QueueHandle_t simCapture = simQueue;
+  if (uartNum == 0 && simCapture != NULL) {
+    // simulated MCU
+    simFrameStruct sf;
+    sf.sentUs = esp_timer_get_time();
+    sf.len = min(txLen, (size_t)BUFF_LEN);
+    memcpy(sf.data, txData, sf.len);
+    xQueueSend(simCapture, &sf, 0);
+    return txLen;
+  }
+  if (uartNum != vuartNum) return uart_write_bytes((uart_port_t)(uartNum + uOffset), txData, txLen);
+  int sent = txLen; // discarded if no client
+  xSemaphoreTake(vuartMutex, portMAX_DELAY);
+  if (vuartSock >= 0) {
+    sent = send(vuartSock, txData, txLen, 0);
+    if (sent < 0) LOG_WRN("Virtual %s uart send error %d", uart[uartNum].uartName, errno);
+  }
+  xSemaphoreGive(vuartMutex);
+  return sent;
+}
+
+static void vuartClose() {
+  xSemaphoreTake(vuartMutex, portMAX_DELAY);
+  close(vuartSock);
+  vuartSock = -1;
+  xSemaphoreGive(vuartMutex);
+  LOG_INF("Virtual %s uart client disconnected", uart[vuartNum].uartName);
+}
+
+static bool startVirtualUart(uart_port_t uartNum) {
+  // listen for virtual uart client instead of configuring physical uart
+  vuartListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (vuartListen >= 0) {
+    int reuse = 1;
+    setsockopt(vuartListen, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(vuartPort);
+    if (bind(vuartListen, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(vuartListen, 1) == 0) {
+      vuartMutex = xSemaphoreCreateMutex();
+      vuartNum = uartNum;
+      LOG_INF("Virtual %s uart listening on port %d", uart[uartNum].uartName, vuartPort);
+      return true;
+    }
+    close(vuartListen);
+    vuartListen = -1;
+  }
+  LOG_ERR("Failed to start virtual %s uart on port %d, error %d", uart[uartNum].uartName, vuartPort, errno);
+  return false;
+}
+
+/************************ frame rewrite rules ************************/
+
+// Rules loaded from a file in the data folder are applied to sniffed frames before forwarding.
+// Each line is: dir cmd dp cond action [arg]
+//   dir: M (to MCU), W (to wifi) or *, cmd and dp: number or *
+//   cond: * or operator = ! < > followed by value, compared to DP integer value
+//   action: drop, delay ms, or set value to replace DP value
+// eg to clamp target temperature sent to MCU: M 6 2 >300 set 300
+// The first matching rule is applied, and the checksum recomputed if the frame is changed.
+// Rules are compiled into a per direction command bitmap so that frames without a possible 
+// match are forwarded without further checks. While rules are loaded, frames are forwarded
+// whole once received rather than byte by byte, and bytes outside a valid frame are not forwarded.
+// Frames too long for the frame buffer are forwarded unmodified byte by byte.
+
+#define MAX_RULES 16
+#define RULE_TEXT_LEN 40
+#define DELAY_FRAMES 8 // max delayed frames awaiting send
+
+enum ruleAction {RULE_DROP, RULE_DELAY, RULE_SET};
+
+struct ruleStruct {
+  uint8_t dirMask; // bit per destination uart
+  int16_t cmd; // -1 for any
+  int16_t dp; // -1 for any
+  char op; // 0 for any value
+  uint8_t action;
+  int32_t value; // compared to DP value
+  int32_t arg; // delay ms or replacement value
+  uint32_t hits;
+  char text[RULE_TEXT_LEN];
+};
+
+struct delayedStruct {
+  int64_t dueUs;
+  int uartNum;
+  size_t frameLen;
+  byte frame[BUFF_LEN];
+};
+
+static ruleStruct rules[MAX_RULES];
+static int ruleCnt = 0;
+static uint32_t ruleCmds[2][8]; // bitmap of commands having rules, per destination uart
+static QueueHandle_t delayQueue = NULL;
+
+static bool compileRule(const char* ruleLine, ruleStruct& rule) {
+  // convert text rule into matcher
+  char dirStr[4], cmdStr[8], dpStr[8], condStr[16], actStr[8];
+  int32_t arg = 0;
+  int items = sscanf(ruleLine, "%3s %7s %7s %15s %7s %ld", dirStr, cmdStr, dpStr, condStr, actStr, &arg);
+  if (items < 5) return false;
+  memset(&rule, 0, sizeof(rule));
+  if (*dirStr == '*') rule.dirMask = 0x03;
+  else if (*dirStr == uart[0].uartId) rule.dirMask = 0x01;
+  else if (*dirStr == uart[1].uartId) rule.dirMask = 0x02;
+  else return false;
+  rule.cmd = *cmdStr == '*' ? -1 : atoi(cmdStr);
+  rule.dp = *dpStr == '*' ? -1 : atoi(dpStr);
+  if (rule.cmd < -1 || rule.cmd > 255 || rule.dp < -1 || rule.dp > 255) return false;
+  if (*condStr != '*') {
+    if (!strchr("=!<>", *condStr)) return false;
+    rule.op = *condStr;
+    rule.value = atol(condStr + 1);
+  }
+  if (!strcmp(actStr, "drop")) rule.action = RULE_DROP;
+  else if (!strcmp(actStr, "delay") && items == 6) rule.action = RULE_DELAY;
+  else if (!strcmp(actStr, "set") && items == 6 && rule.dp >= 0) rule.action = RULE_SET;
+  else return false;
+  rule.arg = arg;
+  strncpy(rule.text, ruleLine, RULE_TEXT_LEN - 1);
+  return true;
+}
+
+static int matchRule(int uartNum, const byte* tuyaData, size_t tuyaDataLen, size_t& unitPos) {
+  // return index of first rule matching frame, and position of matched DP unit
+  for (int r = 0; r < ruleCnt; r++) {
+    ruleStruct& rule = rules[r];
+    if (!(rule.dirMask & (1 << uartNum)) || (rule.cmd >= 0 && rule.cmd != tuyaData[3])) continue;
+    if (rule.dp < 0 && !rule.op) return r;
+    if (tuyaData[3] != 6 && tuyaData[3] != 7) continue; // only DP commands have DP units
+    // check each DP unit: id, type, 2 byte length, value
+    size_t endPos = min((size_t)((tuyaData[4] << 8) | tuyaData[5]) + 6, tuyaDataLen - 1);
+    for (size_t pos = 6; pos + 4 <= endPos; ) {
+      uint16_t unitLen = (tuyaData[pos + 2] << 8) | tuyaData[pos + 3];
+      if (pos + 4 + unitLen > endPos) break;
+      if (rule.dp < 0 || rule.dp == tuyaData[pos]) {
+        int32_t value = dpValue(tuyaData + pos + 4, unitLen);
+        bool hit = !rule.op || (rule.op == '=' && value == rule.value) || (rule.op == '!' && value != rule.value)
+          || (rule.op == '<' && value < rule.value) || (rule.op == '>' && value > rule.value);
+        if (hit) {
+          unitPos = pos;
+          return r;
+        }
+      }
+      pos += 4 + unitLen;
+    }
+  }
+  return -1;
+}
+
+static void delayTask(void* arg) {
+  // send delayed frames in order once due
+  delayedStruct delayed;
+  while (true) {
+    xQueueReceive(delayQueue, &delayed, portMAX_DELAY);
+    int64_t waitUs = delayed.dueUs - esp_timer_get_time();
+    if (waitUs > 0) delay((waitUs + 999) / 1000);
+    uartSend(delayed.uartNum, delayed.frame, delayed.frameLen);
+  }
+}
+
+static void ruleFrame(int uartNum, const byte* tuyaData, size_t tuyaDataLen) {
+  // apply any matching rule to frame destined for uartNum, then forward it
+  int cmd = tuyaData[3];
+  if (!(ruleCmds[uartNum][cmd >> 5] & (1UL << (cmd & 31)))) {
+    uartSend(uartNum, tuyaData, tuyaDataLen);
+    return;
+  }
+  size_t unitPos = 0;
+  int r = matchRule(uartNum, tuyaData, tuyaDataLen, unitPos);
+  if (r < 0) {
+    uartSend(uartNum, tuyaData, tuyaDataLen);
+    return;
+  }
+  ruleStruct& rule = rules[r];
+  rule.hits++;
+  LOG_VRB("Rule %d [%s] applied to frame to %s", r + 1, rule.text, uart[uartNum].uartName);
+  if (rule.action == RULE_DROP) return;
+  if (rule.action == RULE_DELAY) {
+    delayedStruct delayed;
+    delayed.dueUs = esp_timer_get_time() + rule.arg * 1000LL;
+    delayed.uartNum = uartNum;
+    delayed.frameLen = tuyaDataLen;
+    memcpy(delayed.frame, tuyaData, tuyaDataLen);
+    if (xQueueSend(delayQueue, &delayed, 0) != pdTRUE) LOG_WRN("Delay queue full, frame dropped");
+    return;
+  }
+  // RULE_SET: replace integer DP value and recompute checksum
+  byte newFrame[BUFF_LEN];
+  memcpy(newFrame, tuyaData, tuyaDataLen);
+  uint16_t unitLen = (newFrame[unitPos + 2] << 8) | newFrame[unitPos + 3];
+  if (unitLen <= 4) {
+    for (int i = 0; i < unitLen; i++) newFrame[unitPos + 4 + i] = (byte)(rule.arg >> (8 * (unitLen - 1 - i)));
+    newFrame[tuyaDataLen - 1] = 0;
+    for (size_t i = 0; i < tuyaDataLen - 1; i++) newFrame[tuyaDataLen - 1] += newFrame[i];
+  }
+  uartSend(uartNum, newFrame, tuyaDataLen);
 }
 
-static void processTuyaByte(int uartNum, byte tuyaByte) {
-  // build individual message from uart data
-  static int tuyaIdx[2] = {0, 0};
-  static bool haveHdr[2] = {false, false};
-  static uint16_t msgLen[2] = {BUFF_LEN - 10, BUFF_LEN - 10};
+void loadRules(const char* fileName) {
+  // load rules from file in data folder, or clear rules if no file name
+  ruleStruct* newRules = (ruleStruct*)calloc(MAX_RULES, sizeof(ruleStruct));
+  if (newRules == NULL) return;
+  int newCnt = 0;
+  if (strlen(fileName)) {
+    char rulePath[FILE_NAME_LEN];
+    snprintf(rulePath, FILE_NAME_LEN, "%s/%s", DATA_DIR, fileName);
+    File file = STORAGE.open(rulePath, FILE_READ);
+    if (!file) LOG_WRN("Rules file %s not found", rulePath);
+    else {
+      while (file.available() && newCnt < MAX_RULES) {
+        String lineStr = file.readStringUntil('\n');
+        lineStr.trim();
+        if (!lineStr.length() || lineStr[0] == '#') continue;
+        if (compileRule(lineStr.c_str(), newRules[newCnt])) newCnt++;
+        else LOG_WRN("Invalid rule: %s", lineStr.c_str());
+      }
+      file.close();
+    }
+  }
+  if (newCnt && delayQueue == NULL) {
+    delayQueue = xQueueCreate(DELAY_FRAMES, sizeof(delayedStruct));
+    xTaskCreate(delayTask, "delayTask", 1024 * 3, NULL, 2, NULL);
+  }
+  // replace rules while uarts not being read
+  xSemaphoreTake(readMutex, portMAX_DELAY);
+  memcpy(rules, newRules, sizeof(rules));
+  memset(ruleCmds, 0, sizeof(ruleCmds));
+  for (int r = 0; r < newCnt; r++) {
+    for (int u = 0; u < 2; u++) {
+      if (!(rules[r].dirMask & (1 << u))) continue;
+      if (rules[r].cmd < 0) memset(ruleCmds[u], 0xff, sizeof(ruleCmds[u]));
+      else ruleCmds[u][rules[r].cmd >> 5] |= 1UL << (rules[r].cmd & 31);
+    }
+  }
+  // partial frames may already have been forwarded byte by byte, or not at all
+  if (!ruleCnt != !newCnt) for (int u = 0; u < 2; u++) resyncParser(u);
+  for (int u = 0; u < 2; u++) passBytes[u] = 0;
+  ruleCnt = newCnt;
+  xSemaphoreGive(readMutex);
+  free(newRules);
+  LOG_INF("%d frame rules loaded", ruleCnt);
+}
+
+esp_err_t ruleHitsJson(httpd_req_t* req) {
+  // return json of hit count per rule
+  // copy table so not changed by rule reload while being sent
+  ruleStruct* rulesCopy = (ruleStruct*)malloc(sizeof(rules));
+  if (rulesCopy == NULL) return ESP_FAIL;
+  xSemaphoreTake(readMutex, portMAX_DELAY);
+  int rulesCnt = ruleCnt;
+  memcpy(rulesCopy, rules, rulesCnt * sizeof(ruleStruct));
+  xSemaphoreGive(readMutex);
+  char jsonItem[100];
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr_chunk(req, "[");
+  for (int r = 0; r < rulesCnt; r++) {
+    snprintf(jsonItem, sizeof(jsonItem), "%s{\"rule\":\"%s\",\"hits\":%lu}", r ? "," : "", rulesCopy[r].text, rulesCopy[r].hits);
+    httpd_resp_sendstr_chunk(req, jsonItem);
+  }
+  httpd_resp_sendstr_chunk(req, "]");
+  httpd_resp_sendstr_chunk(req, NULL);
+  free(rulesCopy);
+  return ESP_OK;
+}
+
+/**************************** fast replies ****************************/
+
+// In controller mode, housekeeping commands from the MCU are answered directly by the
+// frame parser from a table of prebuilt reply frames, rather than by the round trip 
+// through formatTuya(), processMCUcmd() and processTuyaMsg() text parsing. Templated
+// replies have their data filled in when sent. The reply does not wait for writeMutex
+// as each uart write is atomic, so is not held up by web monitor commands.
+// Both frames are logged after the reply has been sent.
+
+#define FAST_REPLY_LEN 16 // max bytes in reply frame
+
+struct fastReplyStruct {
+  uint8_t cmd;
+  uint16_t dataLen;
+  void (*fillData)(byte* data); // sets templated reply data, NULL if fixed reply
+  byte frame[FAST_REPLY_LEN];
+};
+
+static fastReplyStruct fastReplies[] = {
+  {28, 8, localTimeData}, // local time request
+  {43, 1, networkStatusData}, // network status request
+};
+
+static void prepFastReplies() {
+  // build reply frames, checksum only valid for fixed replies
+  for (auto& fr : fastReplies) {
+    byte* frame = fr.frame;
+    memset(frame, 0, FAST_REPLY_LEN);
+    frame[0] = 0x55;
+    frame[1] = 0xaa;
+    frame[2] = 0x00; // wifi sends version 0
+    frame[3] = fr.cmd;
+    frame[4] = (byte)(fr.dataLen >> 8);
+    frame[5] = (byte)(fr.dataLen & 0xFF);
+    for (int i = 0; i < fr.dataLen + 6; i++) frame[fr.dataLen + 6] += frame[i];
+  }
+}
+
+static bool fastReply(const byte* tuyaData, size_t tuyaDataLen) {
+  // send reply if frame from MCU is a housekeeping command, then log both frames
+  for (auto& fr : fastReplies) {
+    if (fr.cmd != tuyaData[3]) continue;
+    byte reply[FAST_REPLY_LEN];
+    size_t replyLen = fr.dataLen + 7;
+    memcpy(reply, fr.frame, replyLen);
+    if (fr.fillData != NULL) {
+      fr.fillData(reply + 6);
+      reply[replyLen - 1] = 0;
+      for (size_t i = 0; i < replyLen - 1; i++) reply[replyLen - 1] += reply[i];
+    }
+    int wrote = uartSend(0, reply, replyLen);
+    formatTuya(1, tuyaData, tuyaDataLen, false);
+    if (wrote >= 0 && (size_t)wrote == replyLen) formatTuya(0, reply, replyLen, false);
+    else LOG_WRN("Fast reply to cmd %u wrote %d, expected %u", fr.cmd, wrote, replyLen);
+    return true;
+  }
+  return false;
+}
+
+static void processTuyaByte(int uartNum, byte tuyaByte, int64_t byteUs, int p) {
+  // build individual message from uart data, using parser p
   static const uint16_t header = 0x55aa; 
-  static byte tuyaData[2][BUFF_LEN]; // data received from wifi and mcu
-  tuyaData[uartNum][tuyaIdx[uartNum]++] = tuyaByte;
-  if (tuyaIdx[uartNum] > 1 && !haveHdr[uartNum]) {
+  if (passBytes[p]) {
+    // remainder of oversize frame
+    uartSend(uartNum, &tuyaByte, 1);
+    passBytes[p]--;
+  }
+  frameBuff[p][tuyaIdx[p]++] = tuyaByte;
+  if (tuyaIdx[p] > 1 && !haveHdr[p]) {
     // check for header
-    uint16_t tuyaHdr = (tuyaData[uartNum][tuyaIdx[uartNum] - 2] << 8) | tuyaData[uartNum][tuyaIdx[uartNum] - 1];
+    uint16_t tuyaHdr = (frameBuff[p][tuyaIdx[p] - 2] << 8) | frameBuff[p][tuyaIdx[p] - 1];
     if (tuyaHdr == header) {
       // move header to start of buffer
-      haveHdr[uartNum] = true;
-      if (tuyaIdx[uartNum] > 2) LOG_VRB("Invalid msg of %u bytes from %s deleted", tuyaIdx[uartNum] - 2, uart[uartNum].uartName);
-      memmove(tuyaData[uartNum], tuyaData[uartNum] + tuyaIdx[uartNum] - 2, 2);
-      tuyaIdx[uartNum] = 2;
+      haveHdr[p] = true;
+      frameStartUs[p] = prevByteUs[p];
+      if (tuyaIdx[p] > 2) LOG_VRB("Invalid msg of %u bytes from %s deleted", tuyaIdx[p] - 2, uart[uartNum].uartName);
+      memmove(frameBuff[p], frameBuff[p] + tuyaIdx[p] - 2, 2);
+      tuyaIdx[p] = 2;
     }
   }
+  prevByteUs[p] = byteUs;
   // determine msg length
-  if (tuyaIdx[uartNum] == 6 && haveHdr[uartNum]) 
-    msgLen[uartNum] = (tuyaData[uartNum][tuyaIdx[uartNum] - 2] << 8) | tuyaData[uartNum][tuyaIdx[uartNum] - 1];
+  if (tuyaIdx[p] == 6 && haveHdr[p]) {
+    msgLen[p] = (frameBuff[p][tuyaIdx[p] - 2] << 8) | frameBuff[p][tuyaIdx[p] - 1];
+    if (USE_SNIFFER && ruleCnt && msgLen[p] + 7 > BUFF_LEN - 10) {
+      // too long to hold for rules, so forward as received
+      uartSend(uartNum, frameBuff[p], tuyaIdx[p]);
+      passBytes[p] = msgLen[p] + 1;
+    }
+  }
   // send message for formatting and processing when all data received
-  if (tuyaIdx[uartNum] == min(msgLen[uartNum] + 7, BUFF_LEN - 10)) {
-    formatTuya(uartNum, tuyaData[uartNum], tuyaIdx[uartNum], true);
-    if (!USE_SNIFFER) processMCUcmd();
-    // reset for next message
-    haveHdr[uartNum] = false;
-    tuyaIdx[uartNum] = 0;
-    msgLen[uartNum] = BUFF_LEN - 10;
+  if (tuyaIdx[p] == min(msgLen[p] + 7, BUFF_LEN - 10)) {
+    if (!USE_SNIFFER && simQueue != NULL && p != SIM_PARSER) {
+      // real MCU input ignored while MCU simulated
+      simIgnored++;
+      LOG_VRB("Frame from MCU ignored during simulation");
+    }
+    else {
+      if (uartNum == 1) scriptResponse(frameBuff[p], tuyaIdx[p]); // frame from MCU
+      if (USE_SNIFFER) {
+        if (ruleCnt && msgLen[p] + 7 <= BUFF_LEN - 10) ruleFrame(uartNum, frameBuff[p], tuyaIdx[p]);
+        holdFrame(uartNum, frameBuff[p], tuyaIdx[p]);
+      }
+      else if (uartNum == 1 && fastReply(frameBuff[p], tuyaIdx[p])) {
+        // housekeeping command already answered
+      }
+      else {
+        formatTuya(uartNum, frameBuff[p], tuyaIdx[p], true);
+        processMCUcmd();
+      }
+    }
+    // reset for next message, continuing to forward any remainder of oversize frame
+    size_t remainder = passBytes[p];
+    resyncParser(p);
+    passBytes[p] = remainder;
+  }
+}
+
+static void forwardBytes(uart_port_t uartNum, const byte* rxBuff, size_t rxLen) {
+  // forward received bytes if sniffing, and parse
+  uart_port_t otherUart = (uart_port_t)(uartNum ^ 0x01); // flip uart number
+  // forward to other uart if in sniffer mode
+  if (USE_SNIFFER && !ruleCnt) uartSend(otherUart, rxBuff, rxLen); // else forwarded per frame
+  // format for processing
+  for (int i = 0; i < rxLen; i++) {
+    processTuyaByte(otherUart, rxBuff[i], nextByteUs[uartNum], otherUart);
+    nextByteUs[uartNum] += CHAR_US;
+  }
+}
+
+static size_t readChunk(uart_port_t uartNum, size_t maxLen) {
+  // read up to maxLen bytes already in rx buffer, forward if sniffing, and parse
+  byte rxBuff[UART_FIFO_LEN];
+  int rxLen = uart_read_bytes((uart_port_t)(uartNum + uOffset), rxBuff, min(maxLen, sizeof(rxBuff)), 0);
+  if (rxLen <= 0) return 0;
+  forwardBytes(uartNum, rxBuff, rxLen);
+  return rxLen;
+}
+
+static void readVirtual(uart_port_t uartNum) {
+  // wait for data from virtual uart client, or for a client to connect
+  byte rxBuff[UART_FIFO_LEN];
+  int rxLen = 0;
+  if (vuartSock < 0) {
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(vuartListen, &readSet);
+    struct timeval tout = {0, REORDER_MS * 1000};
+    if (select(vuartListen + 1, &readSet, NULL, NULL, &tout) > 0) {
+      int sock = accept(vuartListen, NULL, NULL);
+      if (sock >= 0) {
+        // recv timeout allows held frames to be released
+        struct timeval rxTout = {0, REORDER_MS * 1000};
+        struct timeval txTout = {0, VUART_SEND_MS * 1000};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &rxTout, sizeof(rxTout));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &txTout, sizeof(txTout));
+        int noDelay = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        vuartSock = sock;
+        LOG_INF("Virtual %s uart client connected", uart[uartNum].uartName);
+      }
+    }
+  } else {
+    rxLen = recv(vuartSock, rxBuff, sizeof(rxBuff), 0);
+    if (rxLen == 0 || (rxLen < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) vuartClose();
+  }
+  int64_t eventUs = esp_timer_get_time();
+  xSemaphoreTake(readMutex, portMAX_DELAY); 
+  if (rxLen > 0) {
+    // bytes arrive together, so spaced back from receipt time as if at uart speed
+    nextByteUs[uartNum] = eventUs - (int64_t)(rxLen - 1) * CHAR_US;
+    forwardBytes(uartNum, rxBuff, rxLen);
   }
+  if (USE_SNIFFER) releaseFrames(false);
+  xSemaphoreGive(readMutex);
 }
 
+
 static void readUart(uart_port_t uartNum) {
   // Read data from the given UART when available
-  static const char* uartErr[] = {"FRAME_ERR", "PARITY_ERR", "UART_BREAK", "DATA_BREAK",
-    "BUFFER_FULL", "FIFO_OVF", "UART_DATA", "PATTERN_DET", "EVENT_MAX"};
-  if (xQueueReceive(uartQueue[uartNum], (void*)&uartEvent[uartNum], (TickType_t)portMAX_DELAY)) {
-    xSemaphoreTake(readMutex, portMAX_DELAY); 
-    if (uartEvent[uartNum].type != UART_DATA) {
-      xQueueReset(uartQueue[uartNum]);
-      uart_flush_input((uart_port_t)(uartNum + uOffset));
-      LOG_ERR("%s uart unexpected event type: %s\n", uart[uartNum].uartName, uartErr[uartEvent[uartNum].type]);
-    } else {
-      // uart rx data available
-      byte tuyaByte[1];
-      while (uart_read_bytes((uart_port_t)(uartNum + uOffset), tuyaByte, 1, 20 / portTICK_PERIOD_MS)) {
-        uart_port_t otherUart = (uart_port_t)(uartNum ^ 0x01); // flip uart number
-        // forward to other uart if in sniffer mode
-        if (USE_SNIFFER) uart_write_bytes((uart_port_t)(otherUart + uOffset), tuyaByte, 1);
-        // format for processing
-        processTuyaByte(otherUart, tuyaByte[0]);
-      }
+  // in order of uart_event_type_t
+  static const char* uartErr[] = {"UART_DATA", "UART_BREAK", "BUFFER_FULL", "FIFO_OVF",
+    "FRAME_ERR", "PARITY_ERR", "DATA_BREAK", "PATTERN_DET", "WAKEUP", "EVENT_MAX"};
+  if (uartNum == vuartNum) {
+    readVirtual(uartNum);
+    return;
+  }
+  // in sniffer mode wake periodically to release held frames, if any
+  TickType_t waitTicks = USE_SNIFFER && reorderCnt ? pdMS_TO_TICKS(REORDER_MS) : portMAX_DELAY;
+  bool gotEvent = xQueueReceive(uartQueue[uartNum], (void*)&uartEvent[uartNum], waitTicks);
+  if (gotEvent) stampBuffered(uartNum); // before waiting for mutex
+  xSemaphoreTake(readMutex, portMAX_DELAY); 
+  if (gotEvent) {
+    int evType = uartEvent[uartNum].type;
+    if (evType == UART_FIFO_OVF || evType == UART_BUFFER_FULL || evType == UART_FRAME_ERR || evType == UART_PARITY_ERR) {
+      // overflow or line error, data already in rx buffer is valid so process it rather 
+      // than flush it, then discard the frame in progress as it is missing data
+      size_t buffered = 0;
+      uart_get_buffered_data_len((uart_port_t)(uartNum + uOffset), &buffered);
+      size_t rxLen;
+      while (buffered && (rxLen = readChunk(uartNum, buffered))) buffered -= rxLen;
+      size_t lost = resyncParser(uartNum ^ 0x01);
+      uartEvents[uartNum][evType]++;
+      uartLost[uartNum][evType] += lost;
+      LOG_WRN("%s uart %s discarded %u bytes, totals: %lu events, %lu bytes", uart[uartNum].uartName, 
+        uartErr[evType], lost, uartEvents[uartNum][evType], uartLost[uartNum][evType]);
     }
+    // uart rx data available, read in chunks until buffer empty
+    while (readChunk(uartNum, SIZE_MAX));
   }
+  if (USE_SNIFFER) releaseFrames(false);
   xSemaphoreGive(readMutex);
 }
 
@@ -208,9 +2070,331 @@ static void configureUart(uart_port_t uartNum) {
   };
   
   // install the driver and configure pins
-  uart_driver_install((uart_port_t)(uartNum + uOffset), BUFF_LEN, BUFF_LEN, QUEUE_SIZE, &uartQueue[uartNum], 0);
+  // rx buffer must be larger than hardware fifo
+  uart_driver_install((uart_port_t)(uartNum + uOffset), max(uartRxBuff, (int)BUFF_LEN), BUFF_LEN, QUEUE_SIZE, &uartQueue[uartNum], 0);
   uart_param_config((uart_port_t)(uartNum + uOffset), &uart_config);
   uart_set_pin((uart_port_t)(uartNum + uOffset), uart[uartNum].txPin, uart[uartNum].rxPin, UART_RTS, UART_CTS);
+  // rx event raised when fifo reaches threshold or line idle for timeout, to reduce task wakeups 
+  int thresh = constrain(rxThresh[uartNum] ? rxThresh[uartNum] : AUTO_RX_THRESH, 1, UART_FIFO_LEN - 1);
+  int tout = constrain(rxTimeout[uartNum] ? rxTimeout[uartNum] : AUTO_RX_TOUT, 1, MAX_RX_TOUT);
+  uart_set_rx_full_threshold((uart_port_t)(uartNum + uOffset), thresh);
+  uart_set_rx_timeout((uart_port_t)(uartNum + uOffset), tout);
+  rxThreshUsed[uartNum] = thresh;
+  rxToutUsed[uartNum] = tout;
+  LOG_INF("%s uart rx threshold %d bytes, timeout %d chars", uart[uartNum].uartName, thresh, tout);
+}
+
+/************************* uart transmit queue *************************/
+
+// Frames built by processTuyaMsg() are queued for a writer task, so that callers such as
+// web handlers and the heartbeat return without waiting for the uart. The writer task 
+// waits for each frame to be transmitted, then logs it, records the time from queueing 
+// to transmit done, and calls the optional completion callback with both timestamps.
+
+#define TX_QUEUE_LEN 8
+#define TX_QUEUE_WAIT 100 // ms to wait for space in full queue before dropping frame
+#define TX_DONE_MS 500 // max ms to wait for uart to finish transmitting
+
+struct txFrameStruct {
+  int uartNum;
+  size_t len;
+  int64_t queuedUs;
+  txDoneCB txDone;
+  void* txArg;
+  byte data[BUFF_LEN];
+};
+
+static QueueHandle_t txQueue = NULL;
+static TaskHandle_t txHandle = NULL;
+static latencyStruct txLatency[2]; // queued to transmit done per uart, timeouts are failed sends
+static portMUX_TYPE txLatencyMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void txFailed(int uartNum) {
+  portENTER_CRITICAL(&txLatencyMux);
+  txLatency[uartNum].timeouts++;
+  portEXIT_CRITICAL(&txLatencyMux);
+}
+
+static void txTask(void* arg) {
+  // write each queued frame to its uart
+  txFrameStruct tf;
+  while (true) {
+    xQueueReceive(txQueue, &tf, portMAX_DELAY);
+    bool physical = tf.uartNum != vuartNum && !(tf.uartNum == 0 && simQueue != NULL);
+    int wrote = uartSend(tf.uartNum, tf.data, tf.len);
+    bool sent = wrote >= 0 && (size_t)wrote == tf.len;
+    // physical uart write returns once data is in tx buffer
+    if (sent && physical) sent = uart_wait_tx_done((uart_port_t)(tf.uartNum + uOffset), pdMS_TO_TICKS(TX_DONE_MS)) == ESP_OK;
+    int64_t doneUs = esp_timer_get_time();
+    if (sent) {
+      portENTER_CRITICAL(&txLatencyMux);
+      latencyAdd(txLatency[tf.uartNum], (doneUs - tf.queuedUs) / 1000);
+      portEXIT_CRITICAL(&txLatencyMux);
+      if (!USE_SNIFFER && tf.uartNum == 0 && tf.data[3] == 6) dpWriteSent(tf.data[6]); // time MCU confirmation
+      formatTuya(tf.uartNum, tf.data, tf.len, false);
+    } else {
+      txFailed(tf.uartNum);
+      LOG_WRN("Uart %d wrote %d, expected %u", tf.uartNum, wrote, tf.len);
+    }
+    if (tf.txDone != NULL) tf.txDone(tf.uartNum, tf.data, tf.len, sent, tf.queuedUs, doneUs, tf.txArg);
+  }
+}
+
+static void startTxQueue() {
+  txQueue = xQueueCreate(TX_QUEUE_LEN, sizeof(txFrameStruct));
+  xTaskCreate(txTask, "txTask", 1024 * 4, NULL, 2, &txHandle);
+}
+
+esp_err_t txLatencyJson(httpd_req_t* req) {
+  // return json of time from queueing to transmit done per uart
+  latencyStruct latCopy[2];
+  portENTER_CRITICAL(&txLatencyMux);
+  memcpy(latCopy, txLatency, sizeof(txLatency));
+  portEXIT_CRITICAL(&txLatencyMux);
+  char jsonItem[150];
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr_chunk(req, "{");
+  for (int i = 0; i < 2; i++) {
+    int keyLen = snprintf(jsonItem, sizeof(jsonItem), "%s\"%s\":", i ? "," : "", uart[i].uartName);
+    latencyJson(jsonItem + keyLen, sizeof(jsonItem) - keyLen, latCopy[i]);
+    httpd_resp_sendstr_chunk(req, jsonItem);
+  }
+  httpd_resp_sendstr_chunk(req, "}");
+  httpd_resp_sendstr_chunk(req, NULL);
+  return ESP_OK;
+}
+
+/*************************** simulated MCU ****************************/
+
+// When active, frames written to the MCU are captured instead, for a simulated MCU to 
+// respond to by injecting frames into the input path as if received from the MCU.
+// Injected frames have their own parser, and frames from the real MCU are ignored, 
+// so that real and simulated traffic are not mixed. Note that the controller's own 
+// writes to the MCU, eg heartbeats, are also captured, for the simulation to answer.
+
+#define SIM_QUEUE_LEN 8
+#define SIM_DRAIN_MS 50 // time for any write in progress to complete
+
+bool simulateMCU(bool simulate) {
+  // start or stop capturing writes to MCU, returns false if already started
+  if (simulate) {
+    if (simQueue != NULL) return false;
+    xSemaphoreTake(readMutex, portMAX_DELAY);
+    resyncParser(SIM_PARSER);
+    simIgnored = 0;
+    simQueue = xQueueCreate(SIM_QUEUE_LEN, sizeof(simFrameStruct));
+    xSemaphoreGive(readMutex);
+  } else if (simQueue != NULL) {
+    QueueHandle_t doneQueue = simQueue;
+    simQueue = NULL;
+    delay(SIM_DRAIN_MS);
+    vQueueDelete(doneQueue);
+    if (simIgnored) LOG_WRN("Ignored %lu frames from MCU while simulated", simIgnored);
+  }
+  return true;
+}
+
+bool simReceive(byte* frame, size_t& frameLen, uint32_t waitMs, int64_t* sentUs) {
+  // get next frame written to simulated MCU, waiting up to waitMs
+  simFrameStruct sf;
+  QueueHandle_t simCapture = simQueue;
+  if (simCapture == NULL || xQueueReceive(simCapture, &sf, pdMS_TO_TICKS(waitMs)) != pdTRUE) return false;
+  memcpy(frame, sf.data, sf.len);
+  frameLen = sf.len;
+  if (sentUs != NULL) *sentUs = sf.sentUs;
+  return true;
+}
+
+void simInject(const byte* frame, size_t frameLen) {
+  // process frame from simulated MCU, as received on MCU uart so parsed as bound for wifi
+  int64_t byteUs = esp_timer_get_time();
+  xSemaphoreTake(readMutex, portMAX_DELAY);
+  for (size_t i = 0; i < frameLen; i++) processTuyaByte(1, frame[i], byteUs, SIM_PARSER);
+  xSemaphoreGive(readMutex);
+}
+
+/************************ conformance harness *************************/
+
+// In controller mode, checks the outcome of each command the MCU can originate against the
+// protocol, and the response time against a deadline. A simulated MCU injects each command 
+// into the frame processing path, and captures what would have been written to the MCU.
+// Response time is from injection to the response write, or for an unsolicited DP report
+// to the app config being updated, so excludes uart transfer time.
+// DP status queries can be sent concurrently, as from the web monitor, to load the transmit path.
+// Run with /control?conform=rounds[,query_ms], results are logged.
+
+#define CONFORM_CMDS 5
+#define CONFORM_GAP 10 // ms between commands
+#define CONFORM_DP 8 // child lock DP reported unsolicited, as bool without side effects
+#define CONFORM_KEY "childLock" // app config updated by CONFORM_DP
+
+// expected outcome of command from MCU
+#define EXPECT_REPLY 0 // response frame with respLen data bytes
+#define EXPECT_ACK 1 // no response, or response with no data
+#define EXPECT_STATE 2 // DP report updates app config
+
+struct conformStruct {
+  uint8_t cmd;
+  uint8_t expect;
+  uint16_t respLen; // expected response data length
+  uint32_t passed;
+  uint32_t failed; // wrong or missing response
+  uint32_t late; // correct response after deadline
+  latencyStruct latency;
+};
+
+int conformDeadline = 100; // ms
+static conformStruct conform[CONFORM_CMDS] = {{28, EXPECT_REPLY, 8}, {43, EXPECT_REPLY, 1}, 
+  {4, EXPECT_ACK, 0}, {5, EXPECT_ACK, 0}, {7, EXPECT_STATE, 0}};
+static TaskHandle_t conformHandle = NULL;
+static volatile bool conformQuerying = false;
+static int conformRounds = 0;
+static int conformQueryMs = 0;
+
+static bool conformValid(const conformStruct& cs, const byte* resp, size_t respLen) {
+  // check response frame content from wifi side
+  if (respLen != cs.respLen + 7 || resp[0] != 0x55 || resp[1] != 0xaa || resp[2] != 0x00) return false;
+  if (((resp[4] << 8) | resp[5]) != cs.respLen) return false;
+  byte checksum = 0;
+  for (size_t i = 0; i < respLen - 1; i++) checksum += resp[i];
+  if (checksum != resp[respLen - 1]) return false;
+  if (cs.cmd == 28 && resp[6]) {
+    // valid local time: flag, year, month, day, hour, minute, second, weekday
+    const byte* lt = resp + 6;
+    return lt[2] >= 1 && lt[2] <= 12 && lt[3] >= 1 && lt[3] <= 31 && lt[4] < 24 && lt[5] < 60 && lt[6] < 60 && lt[7] < 7;
+  }
+  if (cs.cmd == 28) return resp[6] == 0;
+  return true;
+}
+
+static void conformQuery(void* arg) {
+  // send DP status queries during run, as web monitor would
+  while (conformQuerying) {
+    processTuyaMsg("M 8");
+    delay(conformQueryMs);
+  }
+  vTaskDelete(NULL);
+}
+
+static bool conformState(conformStruct& cs, const char* expectVal, int64_t& doneUs) {
+  // check app config updated by injected DP report, which is processed synchronously
+  char cfgVal[MAX_PWD_LEN];
+  doneUs = esp_timer_get_time();
+  if (retrieveConfigVal(CONFORM_KEY, cfgVal) && !strcmp(cfgVal, expectVal)) return true;
+  cs.failed++;
+  cs.latency.timeouts++;
+  LOG_WRN("Conformance cmd %u: DP %u report not applied, %s is %s not %s", cs.cmd, CONFORM_DP, CONFORM_KEY, cfgVal, expectVal);
+  return false;
+}
+
+static void conformCmd(conformStruct& cs) {
+  // inject command from simulated MCU and check outcome from controller
+  byte frame[16] = {0x55, 0xaa, 0x03, cs.cmd, 0, 0};
+  size_t frameLen = 6;
+  char expectVal[4] = "";
+  if (cs.cmd == 5) frame[frameLen++] = 0; // reset mode
+  else if (cs.cmd == 7) {
+    // unsolicited report of inverse of current value, so must be propagated
+    char cfgVal[MAX_PWD_LEN];
+    retrieveConfigVal(CONFORM_KEY, cfgVal);
+    byte dpVal = atoi(cfgVal) ? 0 : 1;
+    const byte dpUnit[] = {CONFORM_DP, 1, 0, 1, dpVal};
+    memcpy(frame + frameLen, dpUnit, sizeof(dpUnit));
+    frameLen += sizeof(dpUnit);
+    sprintf(expectVal, "%u", dpVal);
+  }
+  frame[5] = frameLen - 6;
+  frame[frameLen] = 0;
+  for (size_t i = 0; i < frameLen; i++) frame[frameLen] += frame[i];
+  frameLen++;
+  byte resp[BUFF_LEN];
+  size_t respLen;
+  int64_t sentUs;
+  while (simReceive(resp, respLen, 0)); // discard earlier writes
+  int64_t startUs = esp_timer_get_time();
+  simInject(frame, frameLen);
+  if (cs.expect == EXPECT_STATE) {
+    if (!conformState(cs, expectVal, sentUs)) return;
+  } else {
+    // wait twice deadline for late responses, ignoring frames for other commands
+    int64_t endUs = startUs + conformDeadline * 2000LL;
+    bool gotResp = false;
+    int64_t waitUs;
+    while (!gotResp && (waitUs = endUs - esp_timer_get_time()) > 0) {
+      if (!simReceive(resp, respLen, waitUs / 1000 + 1, &sentUs)) break;
+      gotResp = respLen > 3 && resp[3] == cs.cmd;
+    }
+    if (!gotResp) {
+      if (cs.expect == EXPECT_ACK) {
+        // not answering is valid
+        cs.passed++;
+        return;
+      }
+      cs.failed++;
+      cs.latency.timeouts++;
+      LOG_WRN("Conformance cmd %u: no response", cs.cmd);
+      return;
+    }
+  }
+  uint32_t respMs = (sentUs - startUs) / 1000;
+  latencyAdd(cs.latency, respMs);
+  if (cs.expect != EXPECT_STATE && !conformValid(cs, resp, respLen)) {
+    cs.failed++;
+    LOG_WRN("Conformance cmd %u: invalid response of %u bytes", cs.cmd, respLen);
+  } else if (respMs > conformDeadline) cs.late++;
+  else cs.passed++;
+}
+
+static void conformTask(void* arg) {
+  // run each MCU command for number of rounds, then report
+  if (!simulateMCU(true)) {
+    LOG_WRN("Conformance run not started as MCU already simulated");
+    conformHandle = NULL;
+    vTaskDelete(NULL);
+  }
+  LOG_INF("Conformance run of %d rounds started, real MCU traffic suspended", conformRounds);
+  for (auto& cs : conform) {
+    cs.passed = cs.failed = cs.late = 0;
+    memset(&cs.latency, 0, sizeof(cs.latency));
+  }
+  conformQuerying = conformQueryMs > 0;
+  if (conformQuerying) xTaskCreate(conformQuery, "conformQuery", 1024 * 4, NULL, 1, NULL);
+  for (int round = 0; round < conformRounds; round++) {
+    for (auto& cs : conform) {
+      conformCmd(cs);
+      delay(CONFORM_GAP);
+    }
+  }
+  conformQuerying = false;
+  delay(conformQueryMs); // let query task finish
+  simulateMCU(false);
+  // report
+  bool allPassed = true;
+  char summary[100];
+  for (auto& cs : conform) {
+    latencySummary(cs.latency, summary, sizeof(summary));
+    bool cmdPassed = !cs.failed && !cs.late;
+    allPassed &= cmdPassed;
+    LOG_INF("Conformance cmd %u %s: %lu passed, %lu failed, %lu late (deadline %d ms): %s", cs.cmd, 
+      cmdPassed ? "PASS" : "FAIL", cs.passed, cs.failed, cs.late, conformDeadline, summary);
+  }
+  LOG_INF("Conformance run %s", allPassed ? "PASSED" : "FAILED");
+  processTuyaMsg("M 8"); // restore DP state from real MCU
+  conformHandle = NULL;
+  vTaskDelete(NULL);
+}
+
+void runConformance(const char* params) {
+  // start conformance run in controller mode
+  if (USE_SNIFFER || !uartReady || conformHandle != NULL) {
+    LOG_WRN("Conformance run only available in controller mode when not already running");
+    return;
+  }
+  conformRounds = 20;
+  conformQueryMs = 0;
+  sscanf(params, "%d,%d", &conformRounds, &conformQueryMs);
+  if (conformRounds <= 0) return;
+  xTaskCreate(conformTask, "conformTask", 1024 * 4, NULL, 2, &conformHandle);
 }
 
 static void mcuTask(void *arg) {
@@ -244,11 +2428,18 @@ void prepUarts() {
     uart_driver_delete(UART_NUM_0);
   } else uOffset = 1;
   
-  configureUart((uart_port_t)0);
+  prepCapture();
+  prepFastReplies();
+  prepEnergy();
+  startTxQueue();
+  vuartNum = -1;
+  if (vuartSide && (USE_SNIFFER || vuartSide == 1)) startVirtualUart((uart_port_t)(vuartSide - 1));
+  if (vuartNum != 0) configureUart((uart_port_t)0);
   xTaskCreate(mcuTask, "mcuTask", 1024 * 8, NULL, 2, &mcuHandle);
   if (USE_SNIFFER) {
-    configureUart((uart_port_t)1);
+    if (vuartNum != 1) configureUart((uart_port_t)1);
     xTaskCreate(wifiTask, "wifiTask", 1024 * 4, NULL, 2, &wifiHandle);
+    startTap();
   } 
   xSemaphoreGive(readMutex);
   xSemaphoreGive(writeMutex);
@@ -267,12 +2458,14 @@ static int32_t getNumber(const char* consoleCmd, bool start = false) {
   return dataItem;
 }
 
-void processTuyaMsg(const char* wsMsg) {
+void processTuyaMsg(const char* wsMsg, txDoneCB txDone, void* txArg) {
   // receive external Tuya commands from Web monitor or heartbeat task and format then for output
+  // frame is queued for uart writer task, which calls txDone with txArg if given once frame transmitted
   // DP based command input comprises: destination command DP_id data_type data (format depends on data_type)
   // Non DP command input comprises: destination command data_as_individual_bytes
   xSemaphoreTake(writeMutex, portMAX_DELAY);
-  uint8_t tuyaCmd[BUFF_LEN]; // numeric conversion of console command string
+  txFrameStruct tf;
+  uint8_t* tuyaCmd = tf.data; // numeric conversion of console command string
   int uartNum;
   if ((char)wsMsg[0] == uart[0].uartId) uartNum = 0;
   else if ((char)wsMsg[0] == uart[1].uartId) uartNum = 1;
@@ -315,9 +2508,16 @@ void processTuyaMsg(const char* wsMsg) {
   tuyaCmd[++idx] = 0; // checksum is modulo 256 of command content summation 
   for (int i = 0; i < idx; i++) tuyaCmd[idx] += tuyaCmd[i]; 
   
-  // send tuya command to selected uart
-  int tuyaWrote = uart_write_bytes((uart_port_t)(uartNum + uOffset), tuyaCmd, idx + 1);
-  if (tuyaWrote == idx + 1) formatTuya(uartNum, (const byte*)tuyaCmd, tuyaWrote, false);
-  else LOG_WRN("Uart %d wrote %d, expected %d", uartNum, tuyaWrote, idx+1);
+  // queue tuya command for selected uart
+  tf.uartNum = uartNum;
+  tf.len = idx + 1;
+  tf.queuedUs = esp_timer_get_time();
+  tf.txDone = txDone;
+  tf.txArg = txArg;
+  // frame is built, so release mutex before any wait for queue space
   xSemaphoreGive(writeMutex);
+  if (txQueue == NULL || xQueueSend(txQueue, &tf, pdMS_TO_TICKS(TX_QUEUE_WAIT)) != pdTRUE) {
+    txFailed(uartNum);
+    LOG_WRN("Uart %d transmit queue full, frame dropped", uartNum);
+  }
 }
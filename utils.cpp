@@ -239,13 +239,137 @@ void resetWatchDog() {
   }
 }
 
-static void statusCheck() {
-  // regular status checks
+/************************** Job executor **************************/
+
+// Slow network jobs (NTP, data file downloads, app ping) are run by a worker task
+// so that the ping callback, which also feeds the watchdog, only enqueues them.
+// Highest priority job runs first, a job not started by its deadline is discarded.
+
+#define MAX_JOBS 8
+
+struct jobStruct {
+  const char* jobName;
+  jobFunc func;
+  uint8_t priority; // higher value runs first
+  uint32_t queued; // millis() when queued
+  uint32_t deadline; // max msecs to wait before starting, 0 for no deadline
+};
+
+static jobStruct jobQueue[MAX_JOBS];
+static int jobCount = 0;
+static const char* runningJob = NULL;
+static volatile bool cancelRunning = false;
+static uint32_t jobsRun = 0, jobsExpired = 0, jobsCancelled = 0;
+static SemaphoreHandle_t jobMutex = NULL;
+static TaskHandle_t jobHandle = NULL;
+
+static bool nextJob(jobStruct& job) {
+  // remove highest priority unexpired job from queue
+  int best = -1;
+  xSemaphoreTake(jobMutex, portMAX_DELAY);
+  for (int i = jobCount - 1; i >= 0; i--) {
+    if (jobQueue[i].deadline && millis() - jobQueue[i].queued > jobQueue[i].deadline) {
+      // missed deadline, discard
+      LOG_VRB("Job %s expired after %lums", jobQueue[i].jobName, millis() - jobQueue[i].queued);
+      jobQueue[i] = jobQueue[--jobCount];
+      jobsExpired++;
+      if (best == jobCount) best = i;
+    } else if (best < 0 || jobQueue[i].priority >= jobQueue[best].priority) best = i;
+  }
+  if (best >= 0) {
+    job = jobQueue[best];
+    jobQueue[best] = jobQueue[--jobCount];
+    runningJob = job.jobName;
+    cancelRunning = false;
+  } else runningJob = NULL;
+  xSemaphoreGive(jobMutex);
+  return best >= 0;
+}
+
+static void jobTask(void* p) {
+  // run queued jobs in priority order
+  jobStruct job;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    while (nextJob(job)) {
+      uint32_t startTime = millis();
+      bool res = job.func();
+      jobsRun++;
+      LOG_VRB("Job %s %s in %lums (waited %lums), totals run %lu, expired %lu, cancelled %lu", job.jobName, 
+        res ? "completed" : "failed", millis() - startTime, startTime - job.queued, jobsRun, jobsExpired, jobsCancelled);
+    }
+  }
+}
+
+static void prepJobs() {
+  // created once at setup, before any task can queue a job
+  jobMutex = xSemaphoreCreateMutex();
+  xTaskCreate(jobTask, "jobTask", JOB_STACK_SIZE, NULL, JOB_PRI, &jobHandle);
+}
+
+bool queueJob(const char* jobName, jobFunc func, uint8_t priority, uint32_t deadline) {
+  // add job to queue unless already queued or running, returns immediately
+  bool res = false;
+  if (jobMutex == NULL) return res;
+  xSemaphoreTake(jobMutex, portMAX_DELAY);
+  bool queued = runningJob != NULL && !strcmp(runningJob, jobName);
+  for (int i = 0; i < jobCount && !queued; i++) queued = !strcmp(jobQueue[i].jobName, jobName);
+  if (!queued) {
+    if (jobCount < MAX_JOBS) {
+      jobQueue[jobCount++] = {jobName, func, priority, millis(), deadline};
+      res = true;
+    } else LOG_WRN("Job queue full, %s not queued", jobName);
+  }
+  xSemaphoreGive(jobMutex);
+  if (res) xTaskNotifyGive(jobHandle);
+  return res;
+}
+
+void cancelJob(const char* jobName) {
+  // remove named job from queue, or all jobs if NULL
+  // a running job is flagged and can check jobCancelled() to stop early
+  if (jobMutex == NULL) return;
+  xSemaphoreTake(jobMutex, portMAX_DELAY);
+  for (int i = jobCount - 1; i >= 0; i--) {
+    if (jobName == NULL || !strcmp(jobQueue[i].jobName, jobName)) {
+      jobQueue[i] = jobQueue[--jobCount];
+      jobsCancelled++;
+    }
+  }
+  if (runningJob != NULL && (jobName == NULL || !strcmp(runningJob, jobName))) cancelRunning = true;
+  xSemaphoreGive(jobMutex);
+}
+
+bool jobCancelled() {
+  // called by running job to check if it should stop
+  return cancelRunning;
+}
+
+static bool appPingJob() {
   doAppPing();
-  if (!timeSynchronized) getLocalNTP();
-  if (!dataFilesChecked) dataFilesChecked = checkDataFiles();
+  return true;
+}
+
+static bool dataFilesJob() {
+  dataFilesChecked = checkDataFiles();
+  return dataFilesChecked;
+}
+
+#if INCLUDE_MQTT
+static bool mqttJob() {
+  startMqttClient();
+  return true;
+}
+#endif
+
+static void statusCheck() {
+  // regular status checks, queued for job task so ping task is not blocked
+  uint32_t deadline = wifiTimeoutSecs * 1000; // requeued on next ping anyway
+  if (!timeSynchronized) queueJob("NTP", getLocalNTP, 3, deadline);
+  if (!dataFilesChecked) queueJob("dataFiles", dataFilesJob, 2, deadline);
+  queueJob("appPing", appPingJob, 1, deadline);
 #if INCLUDE_MQTT
-  if (mqtt_active) startMqttClient();
+  if (mqtt_active) queueJob("mqtt", mqttJob, 1, deadline);
 #endif
 }
 
@@ -316,6 +440,7 @@ static void startPing() {
 }
 
 void stopPing() {
+  cancelJob(); // discard any pending status jobs
   if (pingHandle != NULL) {
     esp_ping_stop(pingHandle);
     esp_ping_delete_session(pingHandle);
@@ -463,7 +588,7 @@ void syncToBrowser(uint32_t browserUTC) {
   }
 }
 
-void formatElapsedTime(char* timeStr, uint32_t timeVal, bool noDays) {
+void formatElapsedTime(char* timeStr, uint64_t timeVal, bool noDays) {
   // elapsed time that app has been running
   uint32_t secs = timeVal / 1000; //convert milliseconds to seconds
   uint32_t mins = secs / 60; //convert seconds to minutes
@@ -878,6 +1003,7 @@ void logSetup() {
   xSemaphoreGive(logSemaphore);
   xSemaphoreGive(logMutex);
   xTaskCreate(logTask, "logTask", LOG_STACK_SIZE, NULL, LOG_PRI, &logHandle);
+  prepJobs();
   if (mlogEnd >= RAM_LOG_LEN) ramLogClear(); // init
   LOG_INF("Setup RAM based log, size %u, starting from %u\n\n", RAM_LOG_LEN, mlogEnd);
   LOG_INF("=============== %s %s ===============", APP_NAME, APP_VER);
@@ -413,3 +413,116 @@ esp_err_t downloadFile(File& df, httpd_req_t* req) {
   } else res = sendChunks(df, req); // send AVI
   return res;
 }
+
+/************** LZSS block compression **************/
+
+// Small window LZSS in the style of heatshrink. Each block of up to LZSS_BLOCK bytes is
+// compressed independently, so RAM use is fixed and a damaged block does not affect others.
+// Output is groups of up to 8 items, each group preceded by a flag byte with bit set for a match.
+// Literal is 1 byte, match is 2 bytes: 12 bit offset back and 4 bit length - LZSS_MIN_MATCH
+
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (15 + LZSS_MIN_MATCH)
+#define LZSS_HASH_BITS 10
+#define LZSS_MAX_CHAIN 8 // limit on match search per byte
+#define LZSS_NONE 0xFFFF
+
+static uint16_t* lzssHead = NULL; // most recent position for each hash
+static uint16_t* lzssPrev = NULL; // previous position with same hash
+
+static inline uint16_t lzssHash(const uint8_t* inPtr) {
+  return ((inPtr[0] << 6) ^ (inPtr[1] << 3) ^ inPtr[2]) & ((1 << LZSS_HASH_BITS) - 1);
+}
+
+size_t lzssCompress(const uint8_t* in, size_t inLen, uint8_t* out, size_t outMax) {
+  // compress block, returns compressed length, or 0 if not smaller than input
+  // not reentrant as uses shared hash chains
+  if (inLen > LZSS_BLOCK) return 0;
+  if (lzssHead == NULL) {
+    lzssHead = (uint16_t*)malloc((1 << LZSS_HASH_BITS) * sizeof(uint16_t));
+    lzssPrev = (uint16_t*)malloc(LZSS_BLOCK * sizeof(uint16_t));
+    if (lzssHead == NULL || lzssPrev == NULL) {
+      LOG_ERR("Failed to allocate compression buffers");
+      free(lzssHead);
+      free(lzssPrev);
+      lzssHead = lzssPrev = NULL;
+      return 0;
+    }
+  }
+  memset(lzssHead, 0xFF, (1 << LZSS_HASH_BITS) * sizeof(uint16_t));
+  outMax = min(outMax, inLen);
+  size_t inPos = 0, outPos = 0, flagPos = 0;
+  uint8_t flagBit = 0;
+  while (inPos < inLen) {
+    if (!flagBit) {
+      // start new group
+      if (outPos >= outMax) return 0;
+      flagPos = outPos++;
+      out[flagPos] = 0;
+      flagBit = 1;
+    }
+    // find longest match from chain of earlier positions with same hash
+    size_t bestLen = 0, bestOff = 0;
+    size_t maxLen = min(inLen - inPos, (size_t)LZSS_MAX_MATCH);
+    if (maxLen >= LZSS_MIN_MATCH) {
+      uint16_t cand = lzssHead[lzssHash(in + inPos)];
+      for (int i = 0; cand != LZSS_NONE && i < LZSS_MAX_CHAIN; i++) {
+        size_t matchLen = 0;
+        while (matchLen < maxLen && in[cand + matchLen] == in[inPos + matchLen]) matchLen++;
+        if (matchLen > bestLen) {
+          bestLen = matchLen;
+          bestOff = inPos - cand;
+          if (matchLen == maxLen) break;
+        }
+        cand = lzssPrev[cand];
+      }
+    }
+    size_t itemLen = 1;
+    if (bestLen >= LZSS_MIN_MATCH) {
+      if (outPos + 2 > outMax) return 0;
+      out[flagPos] |= flagBit;
+      out[outPos++] = bestOff >> 4;
+      out[outPos++] = ((bestOff & 0x0F) << 4) | (bestLen - LZSS_MIN_MATCH);
+      itemLen = bestLen;
+    } else {
+      if (outPos >= outMax) return 0;
+      out[outPos++] = in[inPos];
+    }
+    // add consumed positions to hash chains
+    for (size_t i = 0; i < itemLen; i++, inPos++) {
+      if (inPos + LZSS_MIN_MATCH <= inLen) {
+        uint16_t hash = lzssHash(in + inPos);
+        lzssPrev[inPos] = lzssHead[hash];
+        lzssHead[hash] = inPos;
+      }
+    }
+    flagBit <<= 1;
+  }
+  return outPos < inLen ? outPos : 0;
+}
+
+size_t lzssDecompress(const uint8_t* in, size_t inLen, uint8_t* out, size_t outMax) {
+  // expand block from lzssCompress(), returns expanded length, or 0 if corrupt
+  size_t inPos = 0, outPos = 0;
+  uint8_t flags = 0, flagBit = 0;
+  while (inPos < inLen) {
+    if (!flagBit) {
+      flags = in[inPos++];
+      flagBit = 1;
+      if (inPos >= inLen) break;
+    }
+    if (flags & flagBit) {
+      if (inPos + 2 > inLen) return 0;
+      size_t offset = (in[inPos] << 4) | (in[inPos + 1] >> 4);
+      size_t matchLen = (in[inPos + 1] & 0x0F) + LZSS_MIN_MATCH;
+      inPos += 2;
+      if (!offset || offset > outPos || outPos + matchLen > outMax) return 0;
+      for (size_t i = 0; i < matchLen; i++, outPos++) out[outPos] = out[outPos - offset];
+    } else {
+      if (outPos >= outMax) return 0;
+      out[outPos++] = in[inPos++];
+    }
+    flagBit <<= 1;
+  }
+  return outPos;
+}
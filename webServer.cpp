@@ -395,20 +395,93 @@ static esp_err_t sendCrossOriginHeader(httpd_req_t *req) {
   return ESP_OK;
 }
 
+/********************* websocket send queue ***********************/
+
+// Outbound websocket text is copied into a bounded queue and sent by the httpd task 
+// via its work queue, so logPrint() and other producers never block on a slow browser.
+// When the queue is full either the oldest or the newest message is dropped.
+
+#define WS_QUEUE_LEN 12
+#define WS_MSG_LEN 256
+
+bool wsDropOldest = true; // else drop newest message when queue full
+static char wsQueue[WS_QUEUE_LEN][WS_MSG_LEN];
+static uint8_t wsHead = 0; // oldest queued message
+static uint8_t wsCount = 0; // number of queued messages
+static bool wsWorkPending = false;
+static portMUX_TYPE wsMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t wsQueued = 0, wsSent = 0, wsDropped = 0, wsFailed = 0;
+
+static void wsSendWork(void* arg) {
+  // runs in httpd task to send all queued messages
+  char wsMsg[WS_MSG_LEN];
+  while (true) {
+    portENTER_CRITICAL(&wsMux);
+    if (!wsCount) {
+      wsWorkPending = false;
+      portEXIT_CRITICAL(&wsMux);
+      break;
+    }
+    strcpy(wsMsg, wsQueue[wsHead]);
+    wsHead = (wsHead + 1) % WS_QUEUE_LEN;
+    wsCount--;
+    portEXIT_CRITICAL(&wsMux);
+
+    bool sent = false;
+    if (fdWs >= 0) {
+      httpd_ws_frame_t wsPkt;
+      memset(&wsPkt, 0, sizeof(httpd_ws_frame_t));
+      wsPkt.payload = (uint8_t*)wsMsg;
+      wsPkt.len = strlen(wsMsg);
+      wsPkt.type = HTTPD_WS_TYPE_TEXT;
+      wsPkt.final = true;
+      sent = httpd_ws_send_frame_async(httpServer, fdWs, &wsPkt) == ESP_OK;
+    }
+    if (sent) wsSent++;
+    else {
+      // browser gone or not responding, discard rest of queue
+      wsFailed++;
+      portENTER_CRITICAL(&wsMux);
+      wsDropped += wsCount;
+      wsCount = 0;
+      portEXIT_CRITICAL(&wsMux);
+    }
+  }
+}
+
 bool wsAsyncSendText(const char* wsData) {
   // websockets send text function, used for async logging and status updates
-  if (fdWs >= 0) {
-    // send if connection active
-    httpd_ws_frame_t wsPkt;
-    wsPkt.payload = (uint8_t*)wsData;
-    wsPkt.len = strlen(wsData);
-    wsPkt.type = HTTPD_WS_TYPE_TEXT;
-    wsPkt.final = true;
-    esp_err_t ret = httpd_ws_send_frame_async(httpServer, fdWs, &wsPkt);
-    if (ret != ESP_OK) LOG_WRN("websocket send failed with %s", esp_err_to_name(ret));
-    return ret == ESP_OK ? true : false;
-  } 
-  return false;
+  // queues message for httpd task and returns immediately
+  if (fdWs < 0) return false;
+  bool queued = true;
+  bool doWork = false;
+  portENTER_CRITICAL(&wsMux);
+  if (wsCount >= WS_QUEUE_LEN) {
+    // queue full, apply drop policy
+    wsDropped++;
+    if (wsDropOldest) {
+      wsHead = (wsHead + 1) % WS_QUEUE_LEN;
+      wsCount--;
+    } else queued = false;
+  }
+  if (queued) {
+    char* slot = wsQueue[(wsHead + wsCount) % WS_QUEUE_LEN];
+    strncpy(slot, wsData, WS_MSG_LEN - 1);
+    slot[WS_MSG_LEN - 1] = 0;
+    wsCount++;
+    wsQueued++;
+    if (!wsWorkPending) doWork = wsWorkPending = true;
+  }
+  portEXIT_CRITICAL(&wsMux);
+  if (doWork && httpd_queue_work(httpServer, wsSendWork, NULL) != ESP_OK) wsWorkPending = false;
+  return queued;
+}
+
+const char* wsQueueStats() {
+  // websocket queue counters for status display
+  static char wsStats[80];
+  snprintf(wsStats, sizeof(wsStats), "queued %lu, sent %lu, dropped %lu, failed %lu", wsQueued, wsSent, wsDropped, wsFailed);
+  return wsStats;
 }
 
 void wsAsyncSendBinary(uint8_t* data, size_t len) {